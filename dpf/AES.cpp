@@ -1,5 +1,6 @@
 #include "AES.h"
 #include <cassert>
+#include <immintrin.h>
 
 
 const uint8_t fixed_key[16] = {36,156,50,234,92,230,49,9,174,170,205,160,98,236,29,243};
@@ -17,6 +18,311 @@ block keyGenHelper(block key, block keyRcon)
     return _mm_xor_si128(key, keyRcon);
 }
 
+// VAES kernels: the same rounds on 2 (ymm) or 4 (zmm) blocks per instruction. they handle the
+// largest prefix they can and return its length; the AES-NI loops below do the rest
+#define AES_TARGET_VAES256 __attribute__((target("vaes,avx2")))
+#define AES_TARGET_VAES512 __attribute__((target("vaes,avx512f")))
+
+enum AESMode { AES_ECB, AES_MMO, AES_CTR };
+
+AES_TARGET_VAES512 static inline void broadcast512(const block *roundKeys, __m512i *rk)
+{
+#pragma GCC unroll 16
+    for (int r = 0; r < 11; r++)
+    {
+        // _mm512_broadcast_i32x4 trips -Wuninitialized in some GCC headers
+        int64_t lo = _mm_cvtsi128_si64(roundKeys[r]), hi = _mm_extract_epi64(roundKeys[r], 1);
+        rk[r] = _mm512_set_epi64(hi, lo, hi, lo, hi, lo, hi, lo);
+    }
+}
+
+AES_TARGET_VAES256 static inline void broadcast256(const block *roundKeys, __m256i *rk)
+{
+#pragma GCC unroll 16
+    for (int r = 0; r < 11; r++)
+        rk[r] = _mm256_broadcastsi128_si256(roundKeys[r]);
+}
+
+template <int Mode, int W>
+AES_TARGET_VAES512 static inline void vaes512(const __m512i *rk, const block *in, uint64_t ctr, block *out)
+{
+    __m512i x[W];
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        if (Mode == AES_CTR)
+        {
+            uint64_t c = ctr + 4 * i;
+            x[i] = _mm512_set_epi64(c + 3, c + 3, c + 2, c + 2, c + 1, c + 1, c, c);
+        }
+        else
+            x[i] = _mm512_loadu_si512(in + 4 * i);
+        x[i] = _mm512_xor_si512(x[i], rk[0]);
+    }
+#pragma GCC unroll 16
+    for (int r = 1; r < 10; r++)
+#pragma GCC unroll 16
+        for (int i = 0; i < W; i++)
+            x[i] = _mm512_aesenc_epi128(x[i], rk[r]);
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        x[i] = _mm512_aesenclast_epi128(x[i], rk[10]);
+        if (Mode == AES_MMO)
+            x[i] = _mm512_xor_si512(x[i], _mm512_loadu_si512(in + 4 * i));
+        _mm512_storeu_si512(out + 4 * i, x[i]);
+    }
+}
+
+template <int Mode>
+AES_TARGET_VAES512 static uint64_t vaes512Blocks(const block *roundKeys, const block *in, uint64_t ctr, uint64_t n, block *out)
+{
+    __m512i rk[11];
+    broadcast512(roundKeys, rk);
+    uint64_t idx = 0;
+    for (; idx + 16 <= n; idx += 16)
+        vaes512<Mode, 4>(rk, in + idx, ctr + idx, out + idx);
+    if (idx + 8 <= n)
+    {
+        vaes512<Mode, 2>(rk, in + idx, ctr + idx, out + idx);
+        idx += 8;
+    }
+    if (idx + 4 <= n)
+    {
+        vaes512<Mode, 1>(rk, in + idx, ctr + idx, out + idx);
+        idx += 4;
+    }
+    return idx;
+}
+
+template <int Mode, int W>
+AES_TARGET_VAES256 static inline void vaes256(const __m256i *rk, const block *in, uint64_t ctr, block *out)
+{
+    __m256i x[W];
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        if (Mode == AES_CTR)
+        {
+            uint64_t c = ctr + 2 * i;
+            x[i] = _mm256_set_epi64x(c + 1, c + 1, c, c);
+        }
+        else
+            x[i] = _mm256_loadu_si256((const __m256i *)(in + 2 * i));
+        x[i] = _mm256_xor_si256(x[i], rk[0]);
+    }
+#pragma GCC unroll 16
+    for (int r = 1; r < 10; r++)
+#pragma GCC unroll 16
+        for (int i = 0; i < W; i++)
+            x[i] = _mm256_aesenc_epi128(x[i], rk[r]);
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        x[i] = _mm256_aesenclast_epi128(x[i], rk[10]);
+        if (Mode == AES_MMO)
+            x[i] = _mm256_xor_si256(x[i], _mm256_loadu_si256((const __m256i *)(in + 2 * i)));
+        _mm256_storeu_si256((__m256i *)(out + 2 * i), x[i]);
+    }
+}
+
+template <int Mode>
+AES_TARGET_VAES256 static uint64_t vaes256Blocks(const block *roundKeys, const block *in, uint64_t ctr, uint64_t n, block *out)
+{
+    __m256i rk[11];
+    broadcast256(roundKeys, rk);
+    uint64_t idx = 0;
+    for (; idx + 8 <= n; idx += 8)
+        vaes256<Mode, 4>(rk, in + idx, ctr + idx, out + idx);
+    for (; idx + 2 <= n; idx += 2)
+        vaes256<Mode, 1>(rk, in + idx, ctr + idx, out + idx);
+    return idx;
+}
+
+// MMO of the same blocks under two keys (a and b), the rounds of both interleaved so that 2W
+// blocks are in flight
+template <int W>
+AES_TARGET_VAES512 static inline void vaes512MMO2(const __m512i *rkA, const __m512i *rkB, const block *in, block *outA, block *outB)
+{
+    __m512i a[W], b[W];
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        __m512i p = _mm512_loadu_si512(in + 4 * i);
+        a[i] = _mm512_xor_si512(p, rkA[0]);
+        b[i] = _mm512_xor_si512(p, rkB[0]);
+    }
+#pragma GCC unroll 16
+    for (int r = 1; r < 10; r++)
+#pragma GCC unroll 16
+        for (int i = 0; i < W; i++)
+        {
+            a[i] = _mm512_aesenc_epi128(a[i], rkA[r]);
+            b[i] = _mm512_aesenc_epi128(b[i], rkB[r]);
+        }
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        __m512i p = _mm512_loadu_si512(in + 4 * i);
+        _mm512_storeu_si512(outA + 4 * i, _mm512_xor_si512(_mm512_aesenclast_epi128(a[i], rkA[10]), p));
+        _mm512_storeu_si512(outB + 4 * i, _mm512_xor_si512(_mm512_aesenclast_epi128(b[i], rkB[10]), p));
+    }
+}
+
+AES_TARGET_VAES512 static uint64_t vaes512MMO2Blocks(const block *roundKeysA, const block *roundKeysB, const block *in, uint64_t n, block *outA, block *outB)
+{
+    __m512i rkA[11], rkB[11];
+    broadcast512(roundKeysA, rkA);
+    broadcast512(roundKeysB, rkB);
+    uint64_t idx = 0;
+    for (; idx + 16 <= n; idx += 16)
+        vaes512MMO2<4>(rkA, rkB, in + idx, outA + idx, outB + idx);
+    if (idx + 8 <= n)
+    {
+        vaes512MMO2<2>(rkA, rkB, in + idx, outA + idx, outB + idx);
+        idx += 8;
+    }
+    if (idx + 4 <= n)
+    {
+        vaes512MMO2<1>(rkA, rkB, in + idx, outA + idx, outB + idx);
+        idx += 4;
+    }
+    return idx;
+}
+
+template <int W>
+AES_TARGET_VAES256 static inline void vaes256MMO2(const __m256i *rkA, const __m256i *rkB, const block *in, block *outA, block *outB)
+{
+    __m256i a[W], b[W];
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(in + 2 * i));
+        a[i] = _mm256_xor_si256(p, rkA[0]);
+        b[i] = _mm256_xor_si256(p, rkB[0]);
+    }
+#pragma GCC unroll 16
+    for (int r = 1; r < 10; r++)
+#pragma GCC unroll 16
+        for (int i = 0; i < W; i++)
+        {
+            a[i] = _mm256_aesenc_epi128(a[i], rkA[r]);
+            b[i] = _mm256_aesenc_epi128(b[i], rkB[r]);
+        }
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(in + 2 * i));
+        _mm256_storeu_si256((__m256i *)(outA + 2 * i), _mm256_xor_si256(_mm256_aesenclast_epi128(a[i], rkA[10]), p));
+        _mm256_storeu_si256((__m256i *)(outB + 2 * i), _mm256_xor_si256(_mm256_aesenclast_epi128(b[i], rkB[10]), p));
+    }
+}
+
+AES_TARGET_VAES256 static uint64_t vaes256MMO2Blocks(const block *roundKeysA, const block *roundKeysB, const block *in, uint64_t n, block *outA, block *outB)
+{
+    __m256i rkA[11], rkB[11];
+    broadcast256(roundKeysA, rkA);
+    broadcast256(roundKeysB, rkB);
+    uint64_t idx = 0;
+    for (; idx + 8 <= n; idx += 8)
+        vaes256MMO2<4>(rkA, rkB, in + idx, outA + idx, outB + idx);
+    for (; idx + 2 <= n; idx += 2)
+        vaes256MMO2<1>(rkA, rkB, in + idx, outA + idx, outB + idx);
+    return idx;
+}
+
+template <int W>
+static inline void aesniMMO2(const block *rkA, const block *rkB, const block *in, block *outA, block *outB)
+{
+    block a[W], b[W];
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        a[i] = _mm_xor_si128(in[i], rkA[0]);
+        b[i] = _mm_xor_si128(in[i], rkB[0]);
+    }
+#pragma GCC unroll 16
+    for (int r = 1; r < 10; r++)
+#pragma GCC unroll 16
+        for (int i = 0; i < W; i++)
+        {
+            a[i] = _mm_aesenc_si128(a[i], rkA[r]);
+            b[i] = _mm_aesenc_si128(b[i], rkB[r]);
+        }
+#pragma GCC unroll 16
+    for (int i = 0; i < W; i++)
+    {
+        block p = in[i];
+        outA[i] = _mm_xor_si128(_mm_aesenclast_si128(a[i], rkA[10]), p);
+        outB[i] = _mm_xor_si128(_mm_aesenclast_si128(b[i], rkB[10]), p);
+    }
+}
+
+static bool cpuSupports(AES::Impl impl)
+{
+    switch (impl)
+    {
+    case AES::VAES512:
+        return __builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx512f");
+    case AES::VAES256:
+        return __builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2");
+    default:
+        return __builtin_cpu_supports("aes");
+    }
+}
+
+static AES::Impl detectImpl()
+{
+    if (cpuSupports(AES::VAES512))
+        return AES::VAES512;
+    if (cpuSupports(AES::VAES256))
+        return AES::VAES256;
+    return AES::AESNI;
+}
+
+static AES::Impl gAesImpl = detectImpl();
+
+template <int Mode>
+static uint64_t wideBlocks(const block *roundKeys, const block *in, uint64_t ctr, uint64_t n, block *out)
+{
+    switch (gAesImpl)
+    {
+    case AES::VAES512:
+        return vaes512Blocks<Mode>(roundKeys, in, ctr, n, out);
+    case AES::VAES256:
+        return vaes256Blocks<Mode>(roundKeys, in, ctr, n, out);
+    default:
+        return 0;
+    }
+}
+
+AES::Impl AES::impl() {
+    return gAesImpl;
+}
+
+bool AES::supports(Impl impl) {
+    return cpuSupports(impl);
+}
+
+bool AES::setImpl(Impl impl) {
+    if (!cpuSupports(impl))
+        return false;
+    gAesImpl = impl;
+    return true;
+}
+
+const char* AES::implName(Impl impl) {
+    switch (impl)
+    {
+    case VAES512:
+        return "vaes512";
+    case VAES256:
+        return "vaes256";
+    default:
+        return "aesni";
+    }
+}
+
 AES::AES() {
     uint8_t zerokey[] = {0,0,0,0, 0,0,0,0, 0,0,0,0 , 0,0,0,0};
     setKey(toBlock(zerokey));
@@ -79,7 +385,7 @@ void AES::encryptECB_MMO(const block& plaintext, block& ciphertext) const {
 void AES::encryptECBBlocks(const block* plaintexts, uint64_t blockLength, block* ciphertexts) const {
 
     const uint64_t step = 8;
-    uint64_t idx = 0;
+    uint64_t idx = wideBlocks<AES_ECB>(mRoundKeysEnc, plaintexts, 0, blockLength, ciphertexts);
     uint64_t length = blockLength - blockLength % step;
 
     //std::array<block, step> temp;
@@ -206,7 +512,7 @@ void AES::encryptECBBlocks(const block* plaintexts, uint64_t blockLength, block*
 void AES::encryptECB_MMO_Blocks(const block* plaintexts, uint64_t blockLength, block* ciphertexts) const {
 
     const uint64_t step = 8;
-    uint64_t idx = 0;
+    uint64_t idx = wideBlocks<AES_MMO>(mRoundKeysEnc, plaintexts, 0, blockLength, ciphertexts);
     uint64_t length = blockLength - blockLength % step;
 
     //std::array<block, step> temp;
@@ -313,14 +619,14 @@ void AES::encryptECB_MMO_Blocks(const block* plaintexts, uint64_t blockLength, b
         temp[6] = _mm_aesenclast_si128(temp[6], mRoundKeysEnc[10]);
         temp[7] = _mm_aesenclast_si128(temp[7], mRoundKeysEnc[10]);
 
-    	ciphertexts[idx + 0] = _mm_xor_si128(temp[0], plaintexts[0]);
-    	ciphertexts[idx + 1] = _mm_xor_si128(temp[1], plaintexts[1]);
-    	ciphertexts[idx + 2] = _mm_xor_si128(temp[2], plaintexts[2]);
-    	ciphertexts[idx + 3] = _mm_xor_si128(temp[3], plaintexts[3]);
-    	ciphertexts[idx + 4] = _mm_xor_si128(temp[4], plaintexts[4]);
-    	ciphertexts[idx + 5] = _mm_xor_si128(temp[5], plaintexts[5]);
-    	ciphertexts[idx + 6] = _mm_xor_si128(temp[6], plaintexts[6]);
-    	ciphertexts[idx + 7] = _mm_xor_si128(temp[7], plaintexts[7]);
+    	ciphertexts[idx + 0] = _mm_xor_si128(temp[0], plaintexts[idx + 0]);
+    	ciphertexts[idx + 1] = _mm_xor_si128(temp[1], plaintexts[idx + 1]);
+    	ciphertexts[idx + 2] = _mm_xor_si128(temp[2], plaintexts[idx + 2]);
+    	ciphertexts[idx + 3] = _mm_xor_si128(temp[3], plaintexts[idx + 3]);
+    	ciphertexts[idx + 4] = _mm_xor_si128(temp[4], plaintexts[idx + 4]);
+    	ciphertexts[idx + 5] = _mm_xor_si128(temp[5], plaintexts[idx + 5]);
+    	ciphertexts[idx + 6] = _mm_xor_si128(temp[6], plaintexts[idx + 6]);
+    	ciphertexts[idx + 7] = _mm_xor_si128(temp[7], plaintexts[idx + 7]);
     }
 
     for (; idx < blockLength; ++idx)
@@ -340,10 +646,35 @@ void AES::encryptECB_MMO_Blocks(const block* plaintexts, uint64_t blockLength, b
     }
 }
 
+void AES::encryptECB_MMO_Blocks2(const AES& other, const block* plaintexts, uint64_t blockLength, block* ciphertexts, block* otherCiphertexts) const {
+    uint64_t idx = 0;
+    switch (gAesImpl)
+    {
+    case VAES512:
+        idx = vaes512MMO2Blocks(mRoundKeysEnc, other.mRoundKeysEnc, plaintexts, blockLength, ciphertexts, otherCiphertexts);
+        break;
+    case VAES256:
+        idx = vaes256MMO2Blocks(mRoundKeysEnc, other.mRoundKeysEnc, plaintexts, blockLength, ciphertexts, otherCiphertexts);
+        break;
+    default:
+        break;
+    }
+    for (; idx + 4 <= blockLength; idx += 4)
+        aesniMMO2<4>(mRoundKeysEnc, other.mRoundKeysEnc, plaintexts + idx, ciphertexts + idx, otherCiphertexts + idx);
+    if (idx + 2 <= blockLength)
+    {
+        aesniMMO2<2>(mRoundKeysEnc, other.mRoundKeysEnc, plaintexts + idx, ciphertexts + idx, otherCiphertexts + idx);
+        idx += 2;
+    }
+    if (idx < blockLength)
+        aesniMMO2<1>(mRoundKeysEnc, other.mRoundKeysEnc, plaintexts + idx, ciphertexts + idx, otherCiphertexts + idx);
+}
+
 void AES::encryptCTR(uint64_t baseIdx, uint64_t blockLength, block * ciphertext) const {
 
     const uint64_t step = 8;
-    uint64_t idx = 0;
+    uint64_t idx = wideBlocks<AES_CTR>(mRoundKeysEnc, ciphertext, baseIdx, blockLength, ciphertext);
+    baseIdx += idx;
     uint64_t length = blockLength - blockLength % step;
 
     //std::array<block, step> temp;
@@ -10,6 +10,16 @@
 
 class AES {
 public:
+    // round implementations for the *Blocks and CTR methods; the widest one the CPU supports is
+    // picked at startup, AESNI is the fallback
+    enum Impl { AESNI, VAES256, VAES512 };
+    static Impl impl();
+    static bool supports(Impl impl);
+    // switches every AES instance, false if the CPU lacks it. not thread safe, meant for tests
+    // and benchmarks
+    static bool setImpl(Impl impl);
+    static const char* implName(Impl impl);
+
     AES();
     AES(const block& key);
     AES(const uint8_t* key);
@@ -38,6 +48,9 @@ public:
     }
     void encryptECBBlocks(const block* plaintexts, uint64_t blockLength, block* ciphertexts) const;
     void encryptECB_MMO_Blocks(const block* plaintexts, uint64_t blockLength, block* ciphertexts) const;
+    // encryptECB_MMO_Blocks under this key into ciphertexts and under other into otherCiphertexts,
+    // with the rounds of both keys interleaved in one pass
+    void encryptECB_MMO_Blocks2(const AES& other, const block* plaintexts, uint64_t blockLength, block* ciphertexts, block* otherCiphertexts) const;
 
     void encryptCTR(uint64_t baseIdx, uint64_t blockLength, block * ciphertext) const;
     block key;
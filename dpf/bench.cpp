@@ -1,8 +1,65 @@
 #include "dpf.h"
+#include "AES.h"
 #include "hashdatastore.h"
 
 #include <chrono>
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include "omp.h"
+
+void benchAES(size_t N, size_t iter) {
+    std::cout << "AES implementations, " << iter << " iterations" << std::endl;
+    auto keys = DPF::Gen(0, N);
+    std::vector<block> in(1ULL << 16), out(1ULL << 16);
+    AES::Impl prev = AES::impl();
+    for (AES::Impl impl : {AES::AESNI, AES::VAES256, AES::VAES512}) {
+        if (!AES::setImpl(impl)) {
+            continue;
+        }
+        auto time1 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            for (size_t j = 0; j < in.size(); j += 8) {
+                mAesFixedKey.encryptECB_MMO_Blocks(in.data() + j, 8, out.data() + j);
+            }
+        }
+        auto time2 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            mAesFixedKey.encryptECB_MMO_Blocks(in.data(), in.size(), out.data());
+        }
+        auto time3 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            std::vector<uint8_t> aaaa = DPF::EvalFull8(keys.first, N);
+        }
+        auto time4 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> blocks8T = time2 - time1, wideT = time3 - time2, evalT = time4 - time3;
+        std::cout << AES::implName(impl) << ": 8-block MMO " << blocks8T.count() << "sec, "
+                  << in.size() << "-block MMO " << wideT.count() << "sec, EvalFull8 " << evalT.count() << "sec" << std::endl;
+    }
+    AES::setImpl(prev);
+}
+
+void benchGen(size_t N, size_t num_keys) {
+    std::cout << "Gen vs GenBatch, " << num_keys << " keys" << std::endl;
+    std::vector<size_t> alphas;
+    for (size_t i = 0; i < num_keys; i++) {
+        alphas.push_back(i * 7919);
+    }
+    auto time1 = std::chrono::high_resolution_clock::now();
+    for (size_t alpha : alphas) {
+        auto keys = DPF::Gen(alpha, N);
+    }
+    auto time2 = std::chrono::high_resolution_clock::now();
+    auto keys = DPF::GenBatch(alphas, N, 1);
+    auto time3 = std::chrono::high_resolution_clock::now();
+    keys = DPF::GenBatch(alphas, N);
+    auto time4 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> genT = time2 - time1, batchT = time3 - time2, parallelT = time4 - time3;
+    std::cout << "Gen " << num_keys / genT.count() << " keys/sec, GenBatch " << num_keys / batchT.count()
+              << " keys/sec, GenBatch on " << omp_get_max_threads() << " threads " << num_keys / parallelT.count() << " keys/sec" << std::endl;
+}
 
 void benchEvalFull(size_t N, size_t iter) {
     std::chrono::duration<double> buildT, evalT, answerT;
@@ -42,6 +99,64 @@ void benchEvalFull8(size_t N, size_t iter) {
     std::cout << evalT.count() << "sec" << std::endl;
 }
 
+void benchEvalFullIterative(size_t N, size_t iter) {
+    std::cout << "EvalFullIterative, " << iter << " iterations" << std::endl;
+    auto keys = DPF::Gen(0, N);
+    auto a = keys.first;
+    auto time1 = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < iter; i++) {
+        std::vector<uint8_t> aaaa = DPF::EvalFullIterative(a, N);
+    }
+    auto time2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> evalT = time2 - time1;
+    std::cout << evalT.count() << "sec" << std::endl;
+}
+
+void benchEvalFullMany(size_t N, size_t num_keys, size_t iter) {
+    std::cout << "EvalFull8 per key vs EvalFullMany, " << num_keys << " keys, " << iter << " iterations" << std::endl;
+    std::vector<std::vector<uint8_t>> keys;
+    for (size_t k = 0; k < num_keys; k++) {
+        keys.push_back(DPF::Gen(k * 7919, N).first);
+    }
+    auto time1 = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < iter; i++) {
+        std::vector<std::vector<uint8_t>> full;
+        for (const auto& key : keys) {
+            full.push_back(DPF::EvalFull8(key, N));
+        }
+    }
+    auto time2 = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < iter; i++) {
+        std::vector<std::vector<uint8_t>> full = DPF::EvalFullMany(keys, N, 1);
+    }
+    auto time3 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> singleT = time2 - time1, manyT = time3 - time2;
+    std::cout << "EvalFull8 " << singleT.count() << "sec, EvalFullMany " << manyT.count() << "sec" << std::endl;
+}
+
+void benchEvalFullParallel(size_t N, size_t iter) {
+    std::cout << "EvalFullParallel, " << iter << " iterations" << std::endl;
+    auto keys = DPF::Gen(0, N);
+    auto a = keys.first;
+    double base = 0;
+    size_t max_threads = omp_get_max_threads();
+    for (size_t threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+        auto time1 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            std::vector<uint8_t> aaaa = DPF::EvalFullParallel(a, N, threads);
+        }
+        auto time2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> evalT = time2 - time1;
+        if (threads == 1) {
+            base = evalT.count();
+        }
+        std::cout << threads << " threads " << evalT.count() << "sec, speedup " << base / evalT.count() << std::endl;
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
 void benchAnswerPIR(size_t N, size_t iter) {
     std::array<std::chrono::duration<double>,6> answerT = {std::chrono::duration<double>::zero(), };
     std::cout << "AnswerPIR, " << iter << " iterations" << std::endl;
@@ -83,14 +198,316 @@ void benchAnswerPIR(size_t N, size_t iter) {
     std::cout << "AnswerPIR5      " << answerT[5].count() << "sec" << std::endl;
 }
 
+void benchEvalPoints(size_t N, size_t num_points, size_t iter) {
+    std::chrono::duration<double> keywordsT, pointsT;
+    keywordsT = pointsT = std::chrono::duration<double>::zero();
+    std::cout << "EvalKeywords vs EvalPoints, " << num_points << " points, " << iter << " iterations" << std::endl;
+    auto keys = DPF::Gen(0, N);
+    auto a = keys.first;
+    std::mt19937_64 rng(1);
+    std::vector<size_t> points(num_points);
+    for (size_t i = 0; i < num_points; i++) {
+        points[i] = rng() & ((1ULL << N) - 2);
+    }
+    std::sort(points.begin(), points.end());
+    std::vector<uint8_t> resK, resP;
+    for(size_t i = 0; i < iter; i++) {
+        auto time0 = std::chrono::high_resolution_clock::now();
+        DPF::EvalKeywords(a, points, N, resK);
+        auto time1 = std::chrono::high_resolution_clock::now();
+        DPF::EvalPoints(a, points, N, resP);
+        auto time2 = std::chrono::high_resolution_clock::now();
+        keywordsT += time1 - time0;
+        pointsT += time2 - time1;
+    }
+    std::cout << "EvalKeywords " << keywordsT.count() << "sec" << std::endl;
+    std::cout << "EvalPoints   " << pointsT.count() << "sec" << std::endl;
+}
+
+void benchAnswerBatch(size_t N, size_t iter) {
+    std::cout << "AnswerPIR batch, " << iter << " iterations" << std::endl;
+    hashdatastore store;
+    store.reserve(1ULL << N);
+    for (size_t i = 0; i < (1ULL << N); i++) {
+        store.push_back(_mm256_set_epi64x(i, i, i, i));
+    }
+    std::vector<std::vector<uint8_t>> queries;
+    for (size_t q = 0; q < 32; q++) {
+        queries.push_back(DPF::EvalFull8(DPF::Gen(q, N).first, N));
+    }
+    std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> out;
+    for (size_t batch = 1; batch <= queries.size(); batch *= 2) {
+        std::vector<const std::vector<uint8_t> *> query_ptrs;
+        for (size_t q = 0; q < batch; q++) {
+            query_ptrs.push_back(&queries[q]);
+        }
+        auto time1 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            store.answer_pir_batch(query_ptrs, out);
+        }
+        auto time2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> answerT = time2 - time1;
+        std::cout << "batch " << batch << ": " << answerT.count() << "sec, " << (batch * iter) / answerT.count() << " queries/sec" << std::endl;
+    }
+}
+
+void benchAnswerParallel(size_t N, size_t num_slice, size_t iter) {
+    std::cout << "AnswerPIR parallel, " << num_slice << " slices, " << iter << " iterations" << std::endl;
+    hashdatastore store;
+    store.resize_data(num_slice);
+    for (size_t j = 0; j < num_slice; j++) {
+        store.data_s[j].resize(1ULL << N, _mm256_set_epi64x(j, j, j, j));
+    }
+    std::vector<uint8_t> aaaa = DPF::EvalFull8(DPF::Gen(0, N).first, N);
+    auto time1 = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < iter; i++) {
+        for (size_t j = 0; j < num_slice; j++) {
+            store.answer_pir2(aaaa, j);
+        }
+    }
+    auto time2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> serialT = time2 - time1;
+    std::cout << "serial answer_pir2 " << serialT.count() << "sec" << std::endl;
+    size_t max_threads = omp_get_max_threads();
+    for (size_t threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+        time1 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            store.answer_pir_parallel_slices(aaaa, threads);
+        }
+        time2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> answerT = time2 - time1;
+        std::cout << threads << " threads " << answerT.count() << "sec, speedup " << serialT.count() / answerT.count() << std::endl;
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+void benchRecordMajor(size_t logsize, size_t iter) {
+    std::cout << "slice-major vs record-major, " << (32ULL << logsize) / (1 << 20) << " MB, " << iter << " iterations" << std::endl;
+    for (size_t num_slice = 1; num_slice <= 128; num_slice *= 2) {
+        size_t num_rows = (1ULL << logsize) / num_slice;
+        hashdatastore slices, records;
+        slices.resize_data(num_slice);
+        records.resize_data(num_slice);
+        for (size_t j = 0; j < num_slice; j++) {
+            slices.data_s[j].resize(num_rows, _mm256_set_epi64x(j, j, j, j));
+            records.data_s[j].resize(num_rows, _mm256_set_epi64x(j, j, j, j));
+        }
+        records.to_record_major();
+        std::vector<uint8_t> query(num_rows / 8);
+        std::mt19937_64 rng(1);
+        for (auto &byte : query) {
+            byte = rng();
+        }
+        auto time1 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            slices.answer_pir_parallel_slices(query, 1);
+        }
+        auto time2 = std::chrono::high_resolution_clock::now();
+        for(size_t i = 0; i < iter; i++) {
+            records.answer_pir_parallel_slices(query, 1);
+        }
+        auto time3 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> sliceT = time2 - time1;
+        std::chrono::duration<double> recordT = time3 - time2;
+        std::cout << 32 * num_slice << " B records: slice-major " << sliceT.count() << "sec, record-major " << recordT.count() << "sec" << std::endl;
+    }
+}
+
+void benchLeafWidth(size_t full_N, size_t keyword_N, size_t num_points, size_t iter) {
+    std::cout << "leaf width: key size, Gen, EvalFullIterative (logn " << full_N << "), EvalKeywords (logn " << keyword_N
+              << ", " << num_points << " points), " << iter << " iterations" << std::endl;
+    std::mt19937_64 rng(1);
+    std::vector<size_t> points(num_points);
+    for (size_t i = 0; i < num_points; i++) {
+        points[i] = rng() & ((1ULL << keyword_N) - 2);
+    }
+    for (size_t leaf_bits : {DPF::LEAF_BITS_128, DPF::LEAF_BITS_256, DPF::LEAF_BITS_512}) {
+        auto time0 = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < iter * 1000; i++) {
+            auto keys = DPF::Gen(i, keyword_N, leaf_bits);
+        }
+        auto time1 = std::chrono::high_resolution_clock::now();
+        DPF::Key full_key(DPF::Gen(0, full_N, leaf_bits).first, full_N);
+        for (size_t i = 0; i < iter; i++) {
+            std::vector<uint8_t> aaaa = DPF::EvalFullIterative(full_key, full_N);
+        }
+        auto time2 = std::chrono::high_resolution_clock::now();
+        auto keyword_key = DPF::Gen(0, keyword_N, leaf_bits).first;
+        std::vector<uint8_t> res;
+        for (size_t i = 0; i < iter; i++) {
+            DPF::EvalKeywords(keyword_key, points, keyword_N, res);
+        }
+        auto time3 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> genT = time1 - time0, fullT = time2 - time1, keywordsT = time3 - time2;
+        std::cout << (1 << leaf_bits) << "-bit leaves: key " << keyword_key.size() << " bytes, Gen " << genT.count() * 1e6 / (iter * 1000)
+                  << "us/key, EvalFullIterative " << fullT.count() << "sec, EvalKeywords " << keywordsT.count() << "sec" << std::endl;
+    }
+}
+
+void benchAnswerKernels(size_t logsize, size_t iter) {
+    std::cout << "answer kernels, " << (32ULL << logsize) / (1 << 20) << " MB, " << iter << " iterations" << std::endl;
+    const hashdatastore::Kernel initial = hashdatastore::kernel();
+    for (size_t num_slice : {1, 3, 8}) {
+        size_t num_rows = (1ULL << logsize) / num_slice & ~static_cast<size_t>(7);
+        hashdatastore slices, records;
+        slices.resize_data(num_slice);
+        records.resize_data(num_slice);
+        for (size_t j = 0; j < num_slice; j++) {
+            slices.data_s[j].resize(num_rows, _mm256_set_epi64x(j, j, j, j));
+            records.data_s[j].resize(num_rows, _mm256_set_epi64x(j, j, j, j));
+        }
+        records.to_record_major();
+        std::vector<uint8_t> query(num_rows / 8);
+        std::mt19937_64 rng(1);
+        for (auto &byte : query) {
+            byte = rng();
+        }
+        for (size_t k = 0; k < hashdatastore::NUM_KERNELS; k++) {
+            hashdatastore::Kernel kernel = static_cast<hashdatastore::Kernel>(k);
+            if (!hashdatastore::setKernel(kernel))
+                continue;
+            auto time1 = std::chrono::high_resolution_clock::now();
+            for(size_t i = 0; i < iter; i++) {
+                slices.answer_pir_parallel_slices(query, 1);
+            }
+            auto time2 = std::chrono::high_resolution_clock::now();
+            for(size_t i = 0; i < iter; i++) {
+                records.answer_pir_parallel_slices(query, 1);
+            }
+            auto time3 = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> sliceT = time2 - time1;
+            std::chrono::duration<double> recordT = time3 - time2;
+            std::cout << hashdatastore::kernelName(kernel) << ", " << 32 * num_slice << " B records: slice-major " << sliceT.count()
+                      << "sec, record-major " << recordT.count() << "sec" << std::endl;
+        }
+    }
+    hashdatastore::setKernel(initial);
+}
+
+void benchBandwidth(size_t logsize, size_t iter) {
+    // answer scan throughput of every kernel (and prefetch distance) against a STREAM-style copy and
+    // a plain read of a table of the same size, best of iter passes, on all threads
+    const size_t num_threads = omp_get_max_threads();
+    const size_t num_rows = 1ULL << logsize;
+    const double bytes = 32.0 * num_rows;
+    std::cout << "bandwidth, " << (32ULL << logsize) / (1 << 20) << " MB, " << num_threads << " threads, best of " << iter << std::endl;
+    auto best = [&](const std::function<void()> &pass) {
+        std::chrono::duration<double> min = std::chrono::duration<double>::max();
+        for (size_t i = 0; i < iter; i++) {
+            auto time1 = std::chrono::high_resolution_clock::now();
+            pass();
+            auto time2 = std::chrono::high_resolution_clock::now();
+            min = std::min<std::chrono::duration<double>>(min, time2 - time1);
+        }
+        return min.count();
+    };
+
+    // STREAM copy counts the bytes read plus the bytes written
+    std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> a(num_rows, _mm256_set1_epi64x(1)), c(num_rows);
+    double copyT = best([&]() {
+        #pragma omp parallel for num_threads(num_threads) schedule(static)
+        for (size_t i = 0; i < num_rows; i++) {
+            _mm256_store_si256(&c[i], _mm256_load_si256(&a[i]));
+        }
+    });
+    double copyBW = 2 * bytes / copyT / 1e9;
+    std::cout << "copy " << copyBW << " GB/s" << std::endl;
+
+    hashdatastore store;
+    store.dummy(num_rows);
+    std::vector<uint8_t> query(num_rows / 8);
+    std::mt19937_64 rng(1);
+    for (auto &byte : query) {
+        byte = rng();
+    }
+    double readBW = bytes / best([&]() { store.answer_pir_idea_speed_comparison(query); }) / 1e9;
+    std::cout << "read (answer_pir_idea_speed_comparison, 1 thread) " << readBW << " GB/s, " << 100 * readBW / copyBW << "% of copy" << std::endl;
+
+    const hashdatastore::Kernel initial = hashdatastore::kernel();
+    const size_t initial_distance = hashdatastore::prefetchDistance();
+    for (size_t k = 0; k < hashdatastore::NUM_KERNELS; k++) {
+        hashdatastore::Kernel kernel = static_cast<hashdatastore::Kernel>(k);
+        if (!hashdatastore::setKernel(kernel))
+            continue;
+        bool prefetch = kernel == hashdatastore::KERNEL_AVX2_PREFETCH || kernel == hashdatastore::KERNEL_AVX512_PREFETCH;
+        for (size_t distance : {0, 256, 512, 1024, 2048, 4096}) {
+            if (!prefetch && distance)
+                break;
+            hashdatastore::setPrefetchDistance(distance);
+            double answerBW = bytes / best([&]() { store.answer_pir_parallel(query, num_threads); }) / 1e9;
+            std::cout << hashdatastore::kernelName(kernel);
+            if (prefetch)
+                std::cout << ", distance " << distance;
+            std::cout << ": " << answerBW << " GB/s, " << 100 * answerBW / copyBW << "% of copy" << std::endl;
+        }
+    }
+    hashdatastore::setPrefetchDistance(initial_distance);
+    hashdatastore::setKernel(initial);
+}
+
+void benchPlacement(size_t logsize, size_t num_slice, size_t iter) {
+    // the same slice-major table on 4 KB pages, placed on transparent 2 MB pages and partitioned
+    // over the NUMA nodes, answered on all threads
+    const size_t num_threads = omp_get_max_threads();
+    const size_t num_rows = 1ULL << logsize;
+    std::cout << "placement, " << (32ULL * num_slice << logsize) / (1 << 20) << " MB, " << num_threads << " threads, "
+              << hashdatastore::numaNodes().size() << " NUMA nodes, " << iter << " iterations" << std::endl;
+    std::vector<uint8_t> query(num_rows / 8);
+    std::mt19937_64 rng(1);
+    for (auto &byte : query) {
+        byte = rng();
+    }
+    const char *names[] = {"4 KB pages", "transparent 2 MB pages", "2 MB hugetlb pages", "1 GB hugetlb pages"};
+    for (hashdatastore::PageSize pages : {hashdatastore::PAGES_DEFAULT, hashdatastore::PAGES_TRANSPARENT, hashdatastore::PAGES_HUGETLB_2M}) {
+        for (hashdatastore::NumaPolicy numa : {hashdatastore::NUMA_DEFAULT, hashdatastore::NUMA_PARTITION}) {
+            hashdatastore store;
+            store.resize_data(num_slice);
+            for (size_t j = 0; j < num_slice; j++) {
+                store.data_s[j].resize(num_rows, _mm256_set_epi64x(j, j, j, j));
+            }
+            if ((pages != hashdatastore::PAGES_DEFAULT || numa != hashdatastore::NUMA_DEFAULT) && !store.place(pages, numa)) {
+                std::cout << names[pages] << ": not available" << std::endl;
+                break;
+            }
+            store.answer_pir_parallel_slices(query, num_threads);
+            auto time1 = std::chrono::high_resolution_clock::now();
+            for(size_t i = 0; i < iter; i++) {
+                store.answer_pir_parallel_slices(query, num_threads);
+            }
+            auto time2 = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> answerT = time2 - time1;
+            std::cout << names[pages] << (numa == hashdatastore::NUMA_PARTITION ? ", partitioned" : "") << ": " << answerT.count() << "sec" << std::endl;
+        }
+    }
+}
 
 int main(int argc, char** argv) {
+    // bench bandwidth [logsize]: only the memory roofline comparison
+    if (argc > 1 && std::string(argv[1]) == "bandwidth") {
+        benchBandwidth(argc > 2 ? std::stoul(argv[2]) : 24, 10);
+        return 0;
+    }
 
     size_t N = 27;
     size_t iter = 100;
+    benchAES(N, iter);
+    benchGen(48, 100000);
     benchEvalFull(N, iter);
     benchEvalFull8(N, iter);
+    benchEvalFullIterative(N, iter);
+    benchEvalFullParallel(N, iter);
+    benchEvalFullMany(20, 32, iter);
     benchAnswerPIR(25,100);
+    benchAnswerBatch(25, 10);
+    benchAnswerParallel(20, 8, 10);
+    benchRecordMajor(22, 10);
+    benchAnswerKernels(22, 10);
+    benchBandwidth(24, 10);
+    benchPlacement(22, 4, 10);
+    benchEvalPoints(48, 1ULL << 20, 10);
+    benchLeafWidth(N, 48, 1ULL << 20, 10);
 
     return 0;
 
@@ -4,7 +4,11 @@
 #include "AES.h"
 #include "Log.h"
 #include <iostream>
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <random>
+#include <type_traits>
 #include "omp.h"
 
 namespace DPF
@@ -20,19 +24,6 @@ namespace DPF
         {
             return mAesFixedKey2.encryptECB_MMO(seed);
         }
-        inline std::array<block, 8> getL8(const std::array<block, 8> &seed)
-        {
-            std::array<block, 8> out;
-            mAesFixedKey.encryptECB_MMO_Blocks(seed.data(), 8, out.data());
-            return out;
-        }
-
-        inline std::array<block, 8> getR8(const std::array<block, 8> &seed)
-        {
-            std::array<block, 8> out;
-            mAesFixedKey2.encryptECB_MMO_Blocks(seed.data(), 8, out.data());
-            return out;
-        }
     }
     inline block clr(block in)
     {
@@ -42,21 +33,21 @@ namespace DPF
     {
         return !is_zero(in & MSBBlock);
     }
-    inline void clr8(std::array<block, 8> &in)
-    {
-        for (int i = 0; i < 8; i++)
-        {
-            in[i] &= ~MSBBlock;
-        }
-    }
-    inline std::array<uint8_t, 8> getT8(const std::array<block, 8> &in)
+    namespace prg
     {
-        std::array<uint8_t, 8> out;
-        for (int i = 0; i < 8; i++)
+        // L and R children of n seeds: the rounds of both PRG keys run interleaved over all
+        // seeds, then the t bits are split off. L and R must not overlap seed
+        inline void expand(const block *seed, size_t n, block *L, block *R, uint8_t *tL, uint8_t *tR)
         {
-            out[i] = !is_zero(in[i] & MSBBlock);
+            mAesFixedKey.encryptECB_MMO_Blocks2(mAesFixedKey2, seed, n, L, R);
+            for (size_t i = 0; i < n; i++)
+            {
+                tL[i] = getT(L[i]);
+                L[i] = clr(L[i]);
+                tR[i] = getT(R[i]);
+                R[i] = clr(R[i]);
+            }
         }
-        return out;
     }
     inline bool ConvertBit(block in)
     {
@@ -74,9 +65,72 @@ namespace DPF
         return out;
     }
 
-    std::pair<std::vector<uint8_t>, std::vector<uint8_t>> Gen(size_t alpha, size_t logn)
+    // block k of the leaf below seed s, before the final CW; block 0 is ConvertBlock(s)
+    inline block ConvertLeaf(block s, size_t k)
+    {
+        return mAesFixedKey.encryptECB(s ^ _mm_set_epi64x(0, k));
+    }
+
+    // the 2^(leaf_bits - 7) blocks of the leaf below (s, t)
+    inline void Leaf(const Key &key, block s, uint8_t t, block *out)
+    {
+        block tt = _mm_set1_epi8(-t);
+        for (size_t k = 0; k < key.CW.size(); k++)
+        {
+            out[k] = ConvertLeaf(s, k) ^ (key.CW[k] & tt);
+        }
+    }
+
+    // bit x mod 2^leaf_bits of the leaf below (s, t), one AES call whatever the width
+    inline bool LeafBit(const Key &key, block s, uint8_t t, size_t x)
+    {
+        const size_t k = (x & ((1ULL << key.leaf_bits) - 1)) >> 7;
+        reg_arr_union tmp;
+        tmp.reg = ConvertLeaf(s, k) ^ (key.CW[k] & _mm_set1_epi8(-t));
+        return (tmp.arr[(x & 127) / 8] >> ((x & 127) % 8)) & 1;
+    }
+
+    static inline size_t KeyDepth(size_t logn, size_t leaf_bits = LEAF_BITS_128)
+    {
+        return logn >= leaf_bits ? logn - leaf_bits : 0; // pack leaf_bits layers in final CW
+    }
+
+    size_t KeySize(size_t logn, size_t leaf_bits)
+    {
+        return 17 + 18 * KeyDepth(logn, leaf_bits) + (16ULL << (leaf_bits - 7));
+    }
+
+    // s0(16) t0(1), then per level sCW(16) tLCW(1) tRCW(1), then the final CW(16 per 128 leaf bits)
+    Key::Key(const std::vector<uint8_t> &bytes, size_t logn)
+    {
+        leaf_bits = LEAF_BITS_128;
+        for (size_t bits = LEAF_BITS_256; logn && bits <= LEAF_BITS_512; bits++)
+        {
+            if (bytes.size() == KeySize(logn, bits))
+                leaf_bits = bits;
+        }
+        const size_t cw_size = 16ULL << (leaf_bits - 7);
+        assert(bytes.size() >= 17 + cw_size && (bytes.size() - 17 - cw_size) % 18 == 0);
+        const size_t depth = (bytes.size() - 17 - cw_size) / 18;
+        assert(depth <= 64);
+        memcpy(&s0, bytes.data(), 16);
+        t0 = bytes[16];
+        sCW.resize(depth);
+        tLCW = tRCW = 0;
+        for (size_t lvl = 0; lvl < depth; lvl++)
+        {
+            memcpy(&sCW[lvl], bytes.data() + 17 + lvl * 18, 16);
+            tLCW |= uint64_t(bytes[17 + lvl * 18 + 16] & 1) << lvl;
+            tRCW |= uint64_t(bytes[17 + lvl * 18 + 17] & 1) << lvl;
+        }
+        CW.resize(cw_size / 16);
+        memcpy(CW.data(), bytes.data() + bytes.size() - cw_size, cw_size);
+    }
+
+    std::pair<std::vector<uint8_t>, std::vector<uint8_t>> Gen(size_t alpha, size_t logn, size_t leaf_bits)
     {
         assert(logn <= 63);
+        assert(leaf_bits >= LEAF_BITS_128 && leaf_bits <= LEAF_BITS_512);
         assert(static_cast<uint64_t>(alpha) < ((1ULL << logn) - 1));
         std::vector<uint8_t> ka, kb, CW;
         PRNG p = PRNG::getTestPRNG();
@@ -96,26 +150,19 @@ namespace DPF
         kb.push_back(t1);
         //        std::cout << ka.hex() << std::endl;
         //        std::cout << kb.hex() << std::endl;
-        size_t stop = logn >= 7 ? logn - 7 : 0; // pack 7 layers in final CW
+        size_t stop = KeyDepth(logn, leaf_bits);
         for (size_t i = 0; i < stop; i++)
         {
             Log::v("gen", "%d, %d", t0, t1);
             Log::v("gen", s0);
             Log::v("gen", s1);
 
-            block s0L = prg::getL(s0);
-            uint8_t t0L = getT(s0L);
-            s0L = clr(s0L);
-            block s0R = prg::getR(s0);
-            uint8_t t0R = getT(s0R);
-            s0R = clr(s0R);
-
-            block s1L = prg::getL(s1);
-            uint8_t t1L = getT(s1L);
-            s1L = clr(s1L);
-            block s1R = prg::getR(s1);
-            uint8_t t1R = getT(s1R);
-            s1R = clr(s1R);
+            // both parties' seeds in one expansion
+            block seeds[2] = {s0, s1}, sL[2], sR[2];
+            uint8_t tL[2], tR[2];
+            prg::expand(seeds, 2, sL, sR, tL, tR);
+            block s0L = sL[0], s1L = sL[1], s0R = sR[0], s1R = sR[1];
+            uint8_t t0L = tL[0], t1L = tL[1], t0R = tR[0], t1R = tR[1];
 
             if (alpha & (1ULL << (logn - 1 - i)))
             {
@@ -170,40 +217,190 @@ namespace DPF
                     t1 = t1L;
             }
         }
-        reg_arr_union tmp = {ZeroBlock};
-        tmp.arr[(alpha & 127) / 8] = (uint8_t)(1U << ((alpha & 127) % 8));
-        tmp.reg = tmp.reg ^ ConvertBlock(s0) ^ ConvertBlock(s1);
-        CW.insert(CW.end(), (uint8_t *)&tmp.reg, ((uint8_t *)&tmp.reg) + sizeof(tmp.reg));
+        const size_t alpha_block = (alpha & ((1ULL << leaf_bits) - 1)) >> 7;
+        for (size_t k = 0; k < (1ULL << (leaf_bits - 7)); k++)
+        {
+            reg_arr_union tmp = {ZeroBlock};
+            if (k == alpha_block)
+                tmp.arr[(alpha & 127) / 8] = (uint8_t)(1U << ((alpha & 127) % 8));
+            tmp.reg = tmp.reg ^ ConvertLeaf(s0, k) ^ ConvertLeaf(s1, k);
+            CW.insert(CW.end(), (uint8_t *)&tmp.reg, ((uint8_t *)&tmp.reg) + sizeof(tmp.reg));
+        }
         ka.insert(ka.end(), CW.begin(), CW.end());
         kb.insert(kb.end(), CW.begin(), CW.end());
 
         return std::make_pair(ka, kb);
     }
 
-    bool Eval(const std::vector<uint8_t> &key, size_t x, size_t logn)
+    // one byte more than the Gen format at depth 0 and 2 * depth - bitmap bytes less beyond, so
+    // the two sizes never coincide
+    size_t CompactKeySize(size_t logn)
+    {
+        const size_t depth = KeyDepth(logn);
+        return 1 + 16 + 16 * depth + 16 + (2 * depth + 8) / 8;
+    }
+
+    std::vector<uint8_t> CompactKey(const std::vector<uint8_t> &key, size_t logn)
     {
+        assert(logn <= 63);
+        const size_t depth = KeyDepth(logn);
+        // 128-bit leaves only: any other key size, a wider leaf's included, has no compact form
+        if (key.size() != KeySize(logn))
+            return {};
+        std::vector<uint8_t> out(CompactKeySize(logn), 0);
+        out[0] = KEY_FORMAT_COMPACT;
+        uint8_t *seeds = &out[1];
+        uint8_t *bits = &out[1 + 16 * (depth + 2)];
+        memcpy(seeds, key.data(), 16);
+        bits[0] = key[16] & 1;
+        for (size_t lvl = 0; lvl < depth; lvl++)
+        {
+            memcpy(seeds + 16 * (lvl + 1), key.data() + 17 + lvl * 18, 16);
+            bits[(1 + 2 * lvl) / 8] |= (key[17 + lvl * 18 + 16] & 1) << ((1 + 2 * lvl) % 8);
+            bits[(2 + 2 * lvl) / 8] |= (key[17 + lvl * 18 + 17] & 1) << ((2 + 2 * lvl) % 8);
+        }
+        memcpy(seeds + 16 * (depth + 1), key.data() + key.size() - 16, 16);
+        return out;
+    }
+
+    bool DecodeKey(const std::vector<uint8_t> &bytes, size_t logn, std::vector<uint8_t> &key)
+    {
+        if (logn > 63)
+            return false;
+        const size_t depth = KeyDepth(logn);
+        if (bytes.size() == 33 + 18 * depth)
+        {
+            key = bytes;
+            return true;
+        }
+        if (bytes.size() != CompactKeySize(logn) || bytes[0] != KEY_FORMAT_COMPACT)
+            return false;
+        const uint8_t *seeds = &bytes[1];
+        const uint8_t *bits = &bytes[1 + 16 * (depth + 2)];
+        key.resize(33 + 18 * depth);
+        memcpy(key.data(), seeds, 16);
+        key[16] = bits[0] & 1;
+        for (size_t lvl = 0; lvl < depth; lvl++)
+        {
+            memcpy(key.data() + 17 + lvl * 18, seeds + 16 * (lvl + 1), 16);
+            key[17 + lvl * 18 + 16] = (bits[(1 + 2 * lvl) / 8] >> ((1 + 2 * lvl) % 8)) & 1;
+            key[17 + lvl * 18 + 17] = (bits[(2 + 2 * lvl) / 8] >> ((2 + 2 * lvl) % 8)) & 1;
+        }
+        memcpy(key.data() + key.size() - 16, seeds + 16 * (depth + 1), 16);
+        return true;
+    }
+
+    // Gen for the m keys alphas[0..m) at once. the seeds of both parties of every key sit side by
+    // side (2k and 2k + 1), so each level is one expansion of 2m seeds
+    static void GenBatchChunk(const size_t *alphas, size_t m, size_t logn, PRNG &p, std::pair<std::vector<uint8_t>, std::vector<uint8_t>> *out)
+    {
+        const size_t stop = KeyDepth(logn);
+        const size_t key_size = 33 + 18 * stop;
+        std::vector<block> s(2 * m), sL(2 * m), sR(2 * m);
+        std::vector<uint8_t> t(2 * m), tL(2 * m), tR(2 * m);
+        p.get(s.data(), s.size());
+        for (size_t k = 0; k < m; k++)
+        {
+            assert(static_cast<uint64_t>(alphas[k]) < ((1ULL << logn) - 1));
+            const size_t a = 2 * k, b = 2 * k + 1;
+            t[a] = getT(s[a]);
+            t[b] = !t[a];
+            s[a] = clr(s[a]);
+            s[b] = clr(s[b]);
+            out[k].first.resize(key_size);
+            out[k].second.resize(key_size);
+            memcpy(out[k].first.data(), &s[a], 16);
+            out[k].first[16] = t[a];
+            memcpy(out[k].second.data(), &s[b], 16);
+            out[k].second[16] = t[b];
+        }
+        for (size_t lvl = 0; lvl < stop; lvl++)
+        {
+            prg::expand(s.data(), 2 * m, sL.data(), sR.data(), tL.data(), tR.data());
+            for (size_t k = 0; k < m; k++)
+            {
+                const size_t a = 2 * k, b = 2 * k + 1;
+                // KEEP = R, LOSE = L if the bit is set, else the other way round
+                const bool right = alphas[k] & (1ULL << (logn - 1 - lvl));
+                block scw = right ? sL[a] ^ sL[b] : sR[a] ^ sR[b];
+                uint8_t tLCW = tL[a] ^ tL[b] ^ !right;
+                uint8_t tRCW = tR[a] ^ tR[b] ^ right;
+                const block *keep = right ? sR.data() : sL.data();
+                const uint8_t *keep_t = right ? tR.data() : tL.data();
+                const uint8_t keep_tcw = right ? tRCW : tLCW;
+                s[a] = keep[a] ^ (scw & _mm_set1_epi8(-(t[a])));
+                s[b] = keep[b] ^ (scw & _mm_set1_epi8(-(t[b])));
+                t[a] = keep_t[a] ^ (keep_tcw & t[a]);
+                t[b] = keep_t[b] ^ (keep_tcw & t[b]);
+                for (auto *key : {&out[k].first, &out[k].second})
+                {
+                    memcpy(key->data() + 17 + lvl * 18, &scw, 16);
+                    (*key)[17 + lvl * 18 + 16] = tLCW;
+                    (*key)[17 + lvl * 18 + 17] = tRCW;
+                }
+            }
+        }
+        mAesFixedKey.encryptECBBlocks(s.data(), 2 * m, sL.data());
+        for (size_t k = 0; k < m; k++)
+        {
+            reg_arr_union tmp = {ZeroBlock};
+            tmp.arr[(alphas[k] & 127) / 8] = (uint8_t)(1U << ((alphas[k] & 127) % 8));
+            tmp.reg = tmp.reg ^ sL[2 * k] ^ sL[2 * k + 1];
+            memcpy(out[k].first.data() + key_size - 16, &tmp.reg, 16);
+            memcpy(out[k].second.data() + key_size - 16, &tmp.reg, 16);
+        }
+    }
+
+    std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> GenBatch(const std::vector<size_t> &alphas, size_t logn, size_t num_threads)
+    {
+        assert(logn <= 63);
+        if (num_threads == 0)
+            num_threads = omp_get_max_threads();
+        std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> keys(alphas.size());
+        // 64 keys keep the seeds of a chunk (6 KB) in L1
+        const size_t chunk = 64;
+        // clang-format off
+        #pragma omp parallel num_threads(num_threads)
+        {
+            std::random_device rd;
+            block seed = _mm_set_epi32(rd(), rd(), rd(), rd());
+            PRNG p(seed);
+            #pragma omp for schedule(dynamic)
+            for (size_t i = 0; i < alphas.size(); i += chunk)
+            {
+                GenBatchChunk(&alphas[i], std::min(chunk, alphas.size() - i), logn, p, &keys[i]);
+            }
+        }
+        // clang-format on
+        return keys;
+    }
+
+    // the evaluators below are templates on the tree depth: LOGN = 0 runs on the runtime logn,
+    // any other LOGN fixes it at compile time so the level loops fully unroll
+    template <size_t LOGN>
+    static bool EvalDepth(const Key &key, size_t x, size_t logn)
+    {
+        logn = LOGN ? LOGN : logn;
         assert(logn <= 63);
         assert(static_cast<uint64_t>(x) < ((1ULL << logn) - 1));
-        block s;
-        memcpy(&s, key.data(), 16);
-        uint8_t t = key.data()[16];
-        size_t stop = logn >= 7 ? logn - 7 : 0; // pack 7 layers in final CW
+        block s = key.s0;
+        uint8_t t = key.t0;
+        // fixed depths are instantiated for 128-bit leaves only
+        assert(!LOGN || key.leaf_bits == LEAF_BITS_128);
+        const size_t stop = KeyDepth(logn, LOGN ? LEAF_BITS_128 : key.leaf_bits);
+#pragma GCC unroll 64
         for (size_t i = 0; i < stop; i++)
         {
             Log::v("eval", s);
             Log::v("eval", "t: %d", t);
-            block sL = prg::getL(s);
-            uint8_t tL = getT(sL);
-            sL = clr(sL);
-            block sR = prg::getR(s);
-            uint8_t tR = getT(sR);
-            sR = clr(sR);
+            block sL, sR;
+            uint8_t tL, tR;
+            prg::expand(&s, 1, &sL, &sR, &tL, &tR);
             if (t)
             {
-                block sCW;
-                memcpy(&sCW, key.data() + 17 + i * 18, 16);
-                uint8_t tLCW = key.data()[17 + i * 18 + 16];
-                uint8_t tRCW = key.data()[17 + i * 18 + 17];
+                block sCW = key.sCW[i];
+                uint8_t tLCW = key.tL(i);
+                uint8_t tRCW = key.tR(i);
                 Log::v("eval", "tcw %d %d", tLCW, tRCW);
                 tL ^= tLCW;
                 tR ^= tRCW;
@@ -222,36 +419,123 @@ namespace DPF
             }
         }
         Log::v("evalfin", s);
-        if (t)
+        return LeafBit(key, s, t, x);
+    }
+
+    // Eval of 8 points walked down the tree in lockstep, so that every level is a single 8-seed
+    // expansion; bit j of the result is Eval(key, x[j], logn)
+    template <size_t LOGN>
+    static uint8_t Eval8Depth(const Key &key, const size_t *x, size_t logn)
+    {
+        logn = LOGN ? LOGN : logn;
+        assert(logn <= 63);
+        std::array<block, 8> s, sL, sR;
+        std::array<uint8_t, 8> t, tL, tR;
+        s.fill(key.s0);
+        t.fill(key.t0);
+        assert(!LOGN || key.leaf_bits == LEAF_BITS_128);
+        const size_t stop = KeyDepth(logn, LOGN ? LEAF_BITS_128 : key.leaf_bits);
+#pragma GCC unroll 64
+        for (size_t i = 0; i < stop; i++)
         {
-            reg_arr_union tmp;
-            reg_arr_union CW;
-            memcpy(CW.arr, key.data() + key.size() - 16, 16);
-            tmp.reg = CW.reg ^ ConvertBlock(s);
-            return (tmp.arr[(x & 127) / 8] & (1UL << ((x & 127) % 8))) != 0;
+            prg::expand(s.data(), 8, sL.data(), sR.data(), tL.data(), tR.data());
+            block sCW = key.sCW[i];
+            uint8_t tLCW = key.tL(i);
+            uint8_t tRCW = key.tR(i);
+            for (int j = 0; j < 8; j++)
+            {
+                block tt = _mm_set1_epi8(-(t[j]));
+                if (x[j] & (1ULL << (logn - 1 - i)))
+                {
+                    s[j] = sR[j] ^ (sCW & tt);
+                    t[j] = tR[j] ^ (tRCW & t[j]);
+                }
+                else
+                {
+                    s[j] = sL[j] ^ (sCW & tt);
+                    t[j] = tL[j] ^ (tLCW & t[j]);
+                }
+            }
         }
-        else
+        // the leaf block holding each point, k = 0 for 128-bit leaves
+        const size_t leaf_mask = (1ULL << (LOGN ? LEAF_BITS_128 : key.leaf_bits)) - 1;
+        std::array<size_t, 8> k;
+        for (int j = 0; j < 8; j++)
         {
+            k[j] = (x[j] & leaf_mask) >> 7;
+            s[j] = s[j] ^ _mm_set_epi64x(0, k[j]);
+        }
+        std::array<block, 8> conv = ConvertBlock8(s);
+        uint8_t res = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            assert(static_cast<uint64_t>(x[j]) < ((1ULL << logn) - 1));
             reg_arr_union tmp;
-            tmp.reg = ConvertBlock(s);
-            return (tmp.arr[(x & 127) / 8] & (1UL << ((x & 127) % 8))) != 0;
+            tmp.reg = conv[j] ^ (key.CW[k[j]] & _mm_set1_epi8(-(t[j])));
+            res |= ((tmp.arr[(x[j] & 127) / 8] >> ((x[j] & 127) % 8)) & 1) << j;
         }
+        return res;
     }
 
-    void EvalKeywords(const std::vector<uint8_t> &key, std::vector<size_t> hashs, size_t logn, std::vector<uint8_t> &results)
+    // depths with their own instantiation; every other depth maps to the LOGN = 0 one
+    typedef bool (*EvalFn)(const Key &, size_t, size_t);
+    typedef uint8_t (*Eval8Fn)(const Key &, const size_t *, size_t);
+    static const std::array<EvalFn, 64> eval_table = []
+    {
+        std::array<EvalFn, 64> table;
+        table.fill(&EvalDepth<0>);
+        table[20] = &EvalDepth<20>;
+        table[24] = &EvalDepth<24>;
+        table[48] = &EvalDepth<48>;
+        return table;
+    }();
+    static const std::array<Eval8Fn, 64> eval8_table = []
+    {
+        std::array<Eval8Fn, 64> table;
+        table.fill(&Eval8Depth<0>);
+        table[20] = &Eval8Depth<20>;
+        table[24] = &Eval8Depth<24>;
+        table[48] = &Eval8Depth<48>;
+        return table;
+    }();
+
+    bool Eval(const Key &key, size_t x, size_t logn)
     {
+        assert(logn <= 63);
+        return (key.leaf_bits == LEAF_BITS_128 ? eval_table[logn] : &EvalDepth<0>)(key, x, logn);
+    }
+
+    template <size_t LOGN>
+    bool Eval(const Key &key, size_t x)
+    {
+        return key.leaf_bits == LEAF_BITS_128 ? EvalDepth<LOGN>(key, x, LOGN) : EvalDepth<0>(key, x, LOGN);
+    }
+
+    void EvalKeywords(const Key &key, std::vector<size_t> hashs, size_t logn, std::vector<uint8_t> &results, size_t num_threads)
+    {
+        if (num_threads == 0)
+            num_threads = omp_get_max_threads();
         assert((hashs.size() - 1) >= 0);
         results.resize(((hashs.size() - 1) / 8) + 1);
+        assert(logn <= 63);
+        const bool narrow = key.leaf_bits == LEAF_BITS_128;
+        const EvalFn eval = narrow ? eval_table[logn] : &EvalDepth<0>;
+        const Eval8Fn eval8 = narrow ? eval8_table[logn] : &Eval8Depth<0>;
         // clang-format off
-        #pragma omp parallel num_threads(32)
+        #pragma omp parallel num_threads(num_threads)
         {
             #pragma omp for
             for (size_t i = 0; i < hashs.size(); i += 8)
             {
+                if (i + 8 <= hashs.size())
+                {
+                    results[i/8] = eval8(key, &hashs[i], logn);
+                    continue;
+                }
                 uint8_t tmp = 0;
-                for (size_t j = 0; j < 8; j++)
+                for (size_t j = 0; i + j < hashs.size(); j++)
                 {
-                    tmp |= Eval(key, hashs[i + j], logn) << j;
+                    tmp |= eval(key, hashs[i + j], logn) << j;
                 }
                 results[i/8] = tmp;
             }
@@ -260,39 +544,110 @@ namespace DPF
         // clang-format on
     }
 
-    void EvalFullRecursive(const std::vector<uint8_t> &key, block s, uint8_t t, size_t lvl, size_t stop, std::vector<uint8_t> &res)
+    // walks the subtree below (s, t) for the sorted points [first, last), which all share the
+    // path to this node; a child is only expanded if at least one point lies below it
+    void EvalPointsRecursive(const Key &key, block s, uint8_t t, size_t lvl, size_t stop, size_t logn,
+                             const size_t *begin, const size_t *first, const size_t *last, std::vector<uint8_t> &results)
     {
         if (lvl == stop)
         {
+            // every block of a leaf shared by several points is converted once
+            union
+            {
+                block reg[4];
+                uint8_t arr[64];
+            } leaf;
+            Leaf(key, s, t, leaf.reg);
+            const size_t leaf_mask = (1ULL << key.leaf_bits) - 1;
+            for (const size_t *x = first; x != last; x++)
+            {
+                size_t i = x - begin;
+                size_t bit_index = *x & leaf_mask;
+                uint8_t bit = (leaf.arr[bit_index / 8] >> (bit_index % 8)) & 1;
+                results[i / 8] |= bit << (i % 8);
+            }
+            return;
+        }
+        const size_t mask = 1ULL << (logn - 1 - lvl);
+        const size_t *mid = std::partition_point(first, last, [mask](size_t x)
+                                                 { return !(x & mask); });
+        block sCW;
+        uint8_t tLCW = 0, tRCW = 0;
+        if (t)
+        {
+            sCW = key.sCW[lvl];
+            tLCW = key.tL(lvl);
+            tRCW = key.tR(lvl);
+        }
+        if (first != mid)
+        {
+            block sL = prg::getL(s);
+            uint8_t tL = getT(sL);
+            sL = clr(sL);
             if (t)
             {
-                reg_arr_union tmp;
-                reg_arr_union CW;
-                memcpy(CW.arr, key.data() + key.size() - 16, 16);
-                tmp.reg = CW.reg ^ ConvertBlock(s);
-                res.insert(res.end(), &tmp.arr[0], &tmp.arr[16]);
+                tL ^= tLCW;
+                sL ^= sCW;
             }
-            else
+            EvalPointsRecursive(key, sL, tL, lvl + 1, stop, logn, begin, first, mid, results);
+        }
+        if (mid != last)
+        {
+            block sR = prg::getR(s);
+            uint8_t tR = getT(sR);
+            sR = clr(sR);
+            if (t)
             {
-                reg_arr_union tmp;
-                tmp.reg = ConvertBlock(s);
-                res.insert(res.end(), &tmp.arr[0], &tmp.arr[16]);
+                tR ^= tRCW;
+                sR ^= sCW;
             }
+            EvalPointsRecursive(key, sR, tR, lvl + 1, stop, logn, begin, mid, last, results);
+        }
+    }
+
+    void EvalPoints(const Key &key, const std::vector<size_t> &sorted_points, size_t logn, std::vector<uint8_t> &results, size_t num_threads)
+    {
+        if (num_threads == 0)
+            num_threads = omp_get_max_threads();
+        assert(logn <= 63);
+        assert(std::is_sorted(sorted_points.begin(), sorted_points.end()));
+        results.assign((sorted_points.size() + 7) / 8, 0);
+        if (sorted_points.empty())
             return;
+        block s = key.s0;
+        uint8_t t = key.t0;
+        size_t stop = KeyDepth(logn, key.leaf_bits);
+        // every chunk is a multiple of 8 points, so threads never share an output byte;
+        // only the few nodes above each chunk boundary are expanded twice
+        const size_t chunk = 1ULL << 12;
+        const size_t *begin = sorted_points.data();
+        const size_t n = sorted_points.size();
+        // clang-format off
+        #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+        for (size_t i = 0; i < n; i += chunk)
+        {
+            EvalPointsRecursive(key, s, t, 0, stop, logn, begin, begin + i, begin + std::min(i + chunk, n), results);
         }
-        block sL = prg::getL(s);
-        uint8_t tL = getT(sL);
-        sL = clr(sL);
-        block sR = prg::getR(s);
-        uint8_t tR = getT(sR);
-        sR = clr(sR);
+        // clang-format on
+    }
+
+    void EvalFullRecursive(const Key &key, block s, uint8_t t, size_t lvl, size_t stop, std::vector<uint8_t> &res)
+    {
+        if (lvl == stop)
+        {
+            block leaf[4];
+            Leaf(key, s, t, leaf);
+            res.insert(res.end(), (uint8_t *)leaf, (uint8_t *)(leaf + key.CW.size()));
+            return;
+        }
+        block sL, sR;
+        uint8_t tL, tR;
+        prg::expand(&s, 1, &sL, &sR, &tL, &tR);
         if (t)
         {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            //            block* sCW = (block*) key.data() + 17 + lvl*18;
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
+            block sCW = key.sCW[lvl];
+            uint8_t tLCW = key.tL(lvl);
+            uint8_t tRCW = key.tR(lvl);
             tL ^= tLCW;
             tR ^= tRCW;
             sL ^= sCW;
@@ -304,48 +659,77 @@ namespace DPF
         EvalFullRecursive(key, sR, tR, lvl + 1, stop, res);
     }
 
-    std::vector<uint8_t> EvalFull(const std::vector<uint8_t> &key, size_t logn)
+    std::vector<uint8_t> EvalFull(const Key &key, size_t logn)
     {
         assert(logn <= 63); // logn = M = 2
         std::vector<uint8_t> data;
-        if (logn >= 7)
+        if (logn >= key.leaf_bits)
             data.reserve(1ULL << (logn - 3));
-        block s;
-        memcpy(&s, key.data(), 16);
-        uint8_t t = key.data()[16];
-        size_t stop = logn >= 7 ? logn - 7 : 0; // pack 7 layers in final CW
+        block s = key.s0;
+        uint8_t t = key.t0;
+        size_t stop = KeyDepth(logn, key.leaf_bits);
         EvalFullRecursive(key, s, t, 0, stop, data);
         return data;
     }
 
-    // optimized for vectorized ops
-    void EvalFullRecursive8(const std::vector<uint8_t> &key, std::array<block, 8> &s, std::array<uint8_t, 8> &t, size_t lvl, size_t stop, std::array<uint8_t *, 8> &res)
+    // one tree level for n nodes: one wide AES call for all L children and one for all R children,
+    // then the level's correction word applied with masks. children of node i go to 2i and 2i + 1;
+    // nodes are visited backwards so that next_s / next_t may be s / t. scratch holds 2n blocks
+    void ExpandLevel(const Key &key, size_t lvl, const block *s, const uint8_t *t, size_t n, block *scratch, block *next_s, uint8_t *next_t)
     {
-        if (lvl == stop)
+        block sCW = key.sCW[lvl];
+        const uint8_t tLCW = key.tL(lvl);
+        const uint8_t tRCW = key.tR(lvl);
+        block *sL = scratch;
+        block *sR = scratch + n;
+        // prg::expand without its separate t pass, the t bits are split off while combining
+        mAesFixedKey.encryptECB_MMO_Blocks2(mAesFixedKey2, s, n, sL, sR);
+        for (size_t i = n; i-- > 0;)
         {
-            std::array<reg_arr_union, 8> tmp;
-            reg_arr_union CW;
-            memcpy(CW.arr, key.data() + key.size() - 16, 16);
-            std::array<block, 8> conv = ConvertBlock8(s);
-            for (int i = 0; i < 8; i++)
-            {
-                block tt = _mm_set1_epi8(-(t[i]));
-                tmp[i].reg = conv[i] ^ (CW.reg & tt);
-                memcpy(res[i], tmp[i].arr, 16);
-                res[i] += sizeof(block);
-            }
-            return;
+            uint8_t ti = t[i];
+            block cw = sCW & _mm_set1_epi8(-ti);
+            next_t[2 * i] = getT(sL[i]) ^ (tLCW & ti);
+            next_t[2 * i + 1] = getT(sR[i]) ^ (tRCW & ti);
+            next_s[2 * i] = clr(sL[i]) ^ cw;
+            next_s[2 * i + 1] = clr(sR[i]) ^ cw;
         }
-        std::array<block, 8> sL = prg::getL8(s);
-        std::array<uint8_t, 8> tL = getT8(sL);
-        clr8(sL);
-        std::array<block, 8> sR = prg::getR8(s);
-        std::array<uint8_t, 8> tR = getT8(sR);
-        clr8(sR);
-        block sCW;
-        memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-        uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-        uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
+    }
+
+    // expands the first depth levels breadth first; the children of node i are 2i and 2i+1
+    void ExpandLevels(const Key &key, size_t depth, std::vector<block> &s, std::vector<uint8_t> &t)
+    {
+        s.resize(1ULL << depth);
+        t.resize(1ULL << depth);
+        s[0] = key.s0;
+        t[0] = key.t0;
+        std::vector<block> scratch(1ULL << depth);
+        for (size_t lvl = 0, n = 1; lvl < depth; lvl++, n *= 2)
+        {
+            ExpandLevel(key, lvl, s.data(), t.data(), n, scratch.data(), s.data(), t.data());
+        }
+    }
+
+    // optimized for vectorized ops; leaf(i, block) receives the leaf blocks below s[i] in order
+    template <typename LeafSink>
+    inline void Leaves8(const Key &key, const std::array<block, 8> &s, const std::array<uint8_t, 8> &t, LeafSink &leaf)
+    {
+        assert(key.leaf_bits == LEAF_BITS_128);
+        const block CW = key.CW[0];
+        std::array<block, 8> conv = ConvertBlock8(s);
+        for (int i = 0; i < 8; i++)
+        {
+            block tt = _mm_set1_epi8(-(t[i]));
+            leaf(i, conv[i] ^ (CW & tt));
+        }
+    }
+
+    inline void Expand8(const Key &key, size_t lvl, const std::array<block, 8> &s, const std::array<uint8_t, 8> &t,
+                        std::array<block, 8> &sL, std::array<uint8_t, 8> &tL, std::array<block, 8> &sR, std::array<uint8_t, 8> &tR)
+    {
+        prg::expand(s.data(), 8, sL.data(), sR.data(), tL.data(), tR.data());
+        block sCW = key.sCW[lvl];
+        uint8_t tLCW = key.tL(lvl);
+        uint8_t tRCW = key.tR(lvl);
         for (int i = 0; i < 8; i++)
         {
             tL[i] ^= (tLCW & t[i]);
@@ -354,12 +738,76 @@ namespace DPF
             sL[i] ^= (sCW & tt);
             sR[i] ^= (sCW & tt);
         }
-        EvalFullRecursive8(key, sL, tL, lvl + 1, stop, res);
-        EvalFullRecursive8(key, sR, tR, lvl + 1, stop, res);
     }
 
-    std::vector<uint8_t> EvalFull8(const std::vector<uint8_t> &key, size_t logn)
+    template <typename LeafSink>
+    void EvalFullLeaves8(const Key &key, std::array<block, 8> &s, std::array<uint8_t, 8> &t, size_t lvl, size_t stop, LeafSink &leaf)
+    {
+        if (lvl == stop)
+        {
+            Leaves8(key, s, t, leaf);
+            return;
+        }
+        std::array<block, 8> sL, sR;
+        std::array<uint8_t, 8> tL, tR;
+        Expand8(key, lvl, s, t, sL, tL, sR, tR);
+        EvalFullLeaves8(key, sL, tL, lvl + 1, stop, leaf);
+        EvalFullLeaves8(key, sR, tR, lvl + 1, stop, leaf);
+    }
+
+    // EvalFullLeaves8 with lvl and stop as types, so that the recursion is laid out at compile time
+    template <size_t STOP, typename LeafSink>
+    void EvalFullLeaves8(const Key &key, std::array<block, 8> &s, std::array<uint8_t, 8> &t,
+                         std::integral_constant<size_t, STOP>, std::integral_constant<size_t, STOP>, LeafSink &leaf)
+    {
+        Leaves8(key, s, t, leaf);
+    }
+
+    template <size_t LVL, size_t STOP, typename LeafSink>
+    void EvalFullLeaves8(const Key &key, std::array<block, 8> &s, std::array<uint8_t, 8> &t,
+                         std::integral_constant<size_t, LVL>, std::integral_constant<size_t, STOP>, LeafSink &leaf)
+    {
+        std::array<block, 8> sL, sR;
+        std::array<uint8_t, 8> tL, tR;
+        Expand8(key, LVL, s, t, sL, tL, sR, tR);
+        EvalFullLeaves8(key, sL, tL, std::integral_constant<size_t, LVL + 1>(), std::integral_constant<size_t, STOP>(), leaf);
+        EvalFullLeaves8(key, sR, tR, std::integral_constant<size_t, LVL + 1>(), std::integral_constant<size_t, STOP>(), leaf);
+    }
+
+    // leaf sink of EvalFull8: the leaves below s[i] go to res[i] in order
+    struct LeafWriter
+    {
+        std::array<uint8_t *, 8> &res;
+        void operator()(int i, const block &b)
+        {
+            memcpy(res[i], &b, sizeof(block));
+            res[i] += sizeof(block);
+        }
+    };
+
+    void EvalFullRecursive8(const Key &key, std::array<block, 8> &s, std::array<uint8_t, 8> &t, size_t lvl, size_t stop, std::array<uint8_t *, 8> &res)
+    {
+        LeafWriter write{res};
+        EvalFullLeaves8(key, s, t, lvl, stop, write);
+    }
+
+    // from level 3 down, at compile time depth STOP or, for STOP = 0, at the runtime stop
+    template <size_t STOP>
+    void EvalFullRecursive8(const Key &key, std::array<block, 8> &s, std::array<uint8_t, 8> &t, size_t stop, std::array<uint8_t *, 8> &res, std::integral_constant<size_t, STOP>)
+    {
+        LeafWriter write{res};
+        EvalFullLeaves8(key, s, t, std::integral_constant<size_t, 3>(), std::integral_constant<size_t, STOP>(), write);
+    }
+
+    void EvalFullRecursive8(const Key &key, std::array<block, 8> &s, std::array<uint8_t, 8> &t, size_t stop, std::array<uint8_t *, 8> &res, std::integral_constant<size_t, 0>)
     {
+        EvalFullRecursive8(key, s, t, 3, stop, res);
+    }
+
+    template <size_t LOGN>
+    static std::vector<uint8_t> EvalFull8Depth(const Key &key, size_t logn)
+    {
+        logn = LOGN ? LOGN : logn;
         assert(logn <= 63);
         std::vector<uint8_t> data;
         data.resize(1ULL << (logn - 3));
@@ -368,143 +816,440 @@ namespace DPF
         {
             data_ptrs[i] = &data[i * (1ULL << (logn - 3 - 3))];
         }
-        block s;
-        memcpy(&s, key.data(), 16);
-        uint8_t t = key.data()[16];
         size_t stop = logn >= 7 ? logn - 7 : 0; // pack 7 layers in final CW
         assert(stop >= 3);                      // need 3 or more layers for this to make sense
-        // evaluate first 3 layers
-        size_t lvl = 0;
-        block sL = prg::getL(s);
-        uint8_t tL = getT(sL);
-        sL = clr(sL);
-        block sR = prg::getR(s);
-        uint8_t tR = getT(sR);
-        sR = clr(sR);
-        if (t)
+        // evaluate first 3 layers, node i heads the subtree written to data_ptrs[i]
+        std::vector<block> top_s;
+        std::vector<uint8_t> top_t;
+        ExpandLevels(key, 3, top_s, top_t);
+        std::array<block, 8> s_array;
+        std::array<uint8_t, 8> t_array;
+        std::copy(top_s.begin(), top_s.end(), s_array.begin());
+        std::copy(top_t.begin(), top_t.end(), t_array.begin());
+
+        EvalFullRecursive8(key, s_array, t_array, stop, data_ptrs, std::integral_constant<size_t, (LOGN >= 10 ? LOGN - 7 : 0)>());
+        return data;
+    }
+
+    typedef std::vector<uint8_t> (*EvalFull8Fn)(const Key &, size_t);
+    static const std::array<EvalFull8Fn, 64> evalfull8_table = []
+    {
+        std::array<EvalFull8Fn, 64> table;
+        table.fill(&EvalFull8Depth<0>);
+        table[20] = &EvalFull8Depth<20>;
+        table[24] = &EvalFull8Depth<24>;
+        return table;
+    }();
+
+    // the recursive walkers below are 128-bit only, wider leaves take the level by level
+    // expansion of EvalFullIterative, which has the same output
+    std::vector<uint8_t> EvalFull8(const Key &key, size_t logn)
+    {
+        assert(logn <= 63);
+        if (key.leaf_bits != LEAF_BITS_128)
+            return EvalFullIterative(key, logn);
+        return evalfull8_table[logn](key, logn);
+    }
+
+    template <size_t LOGN>
+    std::vector<uint8_t> EvalFull8(const Key &key)
+    {
+        if (key.leaf_bits != LEAF_BITS_128)
+            return EvalFullIterative(key, LOGN);
+        return EvalFull8Depth<LOGN>(key, LOGN);
+    }
+
+    // the 2^sub leaves of the subtree below s[0], t[0] at level lvl, expanded level by level in
+    // s / t / scratch (2^sub entries each) and written to out, key.CW.size() blocks per leaf
+    void EvalSubtree(const Key &key, size_t lvl, size_t sub, block *s, uint8_t *t, block *scratch, block *out)
+    {
+        const size_t width = 1ULL << sub;
+        for (size_t n = 1; n < width; lvl++, n *= 2)
         {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
-            tL ^= tLCW;
-            tR ^= tRCW;
-            sL ^= sCW;
-            sR ^= sCW;
+            ExpandLevel(key, lvl, s, t, n, scratch, s, t);
+        }
+        if (key.CW.size() == 1)
+        {
+            mAesFixedKey.encryptECBBlocks(s, width, out);
+            const block CW = key.CW[0];
+            for (size_t i = 0; i < width; i++)
+            {
+                out[i] = out[i] ^ (CW & _mm_set1_epi8(-(t[i])));
+            }
+            return;
+        }
+        // wide leaves: one pass over the subtree per leaf block, interleaved into out
+        const size_t m = key.CW.size();
+        for (size_t k = 0; k < m; k++)
+        {
+            const block ctr = _mm_set_epi64x(0, k);
+            for (size_t i = 0; i < width; i++)
+            {
+                scratch[i] = s[i] ^ ctr;
+            }
+            mAesFixedKey.encryptECBBlocks(scratch, width, scratch);
+            const block CW = key.CW[k];
+            for (size_t i = 0; i < width; i++)
+            {
+                out[i * m + k] = scratch[i] ^ (CW & _mm_set1_epi8(-(t[i])));
+            }
+        }
+    }
+
+    std::vector<uint8_t> EvalFullIterative(const Key &key, size_t logn)
+    {
+        assert(logn <= 63);
+        assert(logn >= key.leaf_bits);
+        const size_t stop = KeyDepth(logn, key.leaf_bits);
+        const size_t leaf_bytes = 16 * key.CW.size();
+        // subtrees of 2^sub leaves (64 KB of seeds) are expanded level by level in cache
+        const size_t sub = std::min<size_t>(stop, 12);
+        const size_t width = 1ULL << sub;
+        std::vector<uint8_t> data(1ULL << (logn - 3));
+        std::vector<block> top_s;
+        std::vector<uint8_t> top_t;
+        ExpandLevels(key, stop - sub, top_s, top_t);
+        std::vector<block> s(width), scratch(width);
+        std::vector<uint8_t> t(width);
+        for (size_t j = 0; j < top_s.size(); j++)
+        {
+            s[0] = top_s[j];
+            t[0] = top_t[j];
+            EvalSubtree(key, stop - sub, sub, s.data(), t.data(), scratch.data(), (block *)&data[j * width * leaf_bytes]);
+        }
+        return data;
+    }
+
+    void EvalFullChunked(const Key &key, size_t logn, size_t chunk_bytes, const std::function<void(size_t, const uint8_t *, size_t)> &chunk)
+    {
+        assert(logn <= 63);
+        assert(logn >= key.leaf_bits);
+        const size_t stop = KeyDepth(logn, key.leaf_bits);
+        const size_t leaf_bytes = 16 * key.CW.size();
+        // a chunk is the subtree of 2^sub leaves, the largest that fits in chunk_bytes
+        size_t sub = 0;
+        while (sub < stop && (leaf_bytes << (sub + 1)) <= chunk_bytes)
+        {
+            sub++;
+        }
+        const size_t width = 1ULL << sub;
+        const size_t top = stop - sub;
+        // the walk down needs room for two children even if the chunk is a single leaf
+        std::vector<block> s(std::max<size_t>(width, 2)), scratch(std::max<size_t>(width, 2)), out(width * key.CW.size());
+        std::vector<uint8_t> t(std::max<size_t>(width, 2));
+        for (size_t j = 0; j < (1ULL << top); j++)
+        {
+            // walk down to subtree j, so nothing above the chunks is kept around
+            s[0] = key.s0;
+            t[0] = key.t0;
+            for (size_t lvl = 0; lvl < top; lvl++)
+            {
+                ExpandLevel(key, lvl, s.data(), t.data(), 1, scratch.data(), s.data(), t.data());
+                if ((j >> (top - 1 - lvl)) & 1)
+                {
+                    s[0] = s[1];
+                    t[0] = t[1];
+                }
+            }
+            EvalSubtree(key, top, sub, s.data(), t.data(), scratch.data(), out.data());
+            chunk(j * width * leaf_bytes, (const uint8_t *)out.data(), width * leaf_bytes);
+        }
+    }
+
+    std::vector<uint8_t> EvalFullParallel(const Key &key, size_t logn, size_t num_threads, size_t split_lvl)
+    {
+        assert(logn <= 63);
+        if (key.leaf_bits != LEAF_BITS_128)
+            return EvalFullIterative(key, logn);
+        size_t stop = logn >= 7 ? logn - 7 : 0; // pack 7 layers in final CW
+        assert(stop >= 3);                      // need 3 or more layers for this to make sense
+        if (split_lvl == 0)
+        {
+            // a few groups of 8 subtrees per thread keeps the dynamic schedule balanced
+            split_lvl = 3;
+            while ((1ULL << split_lvl) < 8 * 4 * num_threads && split_lvl < stop)
+            {
+                split_lvl++;
+            }
+        }
+        assert(split_lvl >= 3 && split_lvl <= stop);
+
+        std::vector<uint8_t> data;
+        data.resize(1ULL << (logn - 3));
+        std::vector<block> s;
+        std::vector<uint8_t> t;
+        ExpandLevels(key, split_lvl, s, t);
+        const size_t subtree_bytes = 1ULL << (logn - 3 - split_lvl);
+        // clang-format off
+        #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+        for (size_t g = 0; g < s.size(); g += 8)
+        {
+            std::array<block, 8> s_array;
+            std::array<uint8_t, 8> t_array;
+            std::array<uint8_t *, 8> data_ptrs;
+            for (size_t i = 0; i < 8; i++)
+            {
+                s_array[i] = s[g + i];
+                t_array[i] = t[g + i];
+                data_ptrs[i] = &data[(g + i) * subtree_bytes];
+            }
+            EvalFullRecursive8(key, s_array, t_array, split_lvl, stop, data_ptrs);
+        }
+        // clang-format on
+        return data;
+    }
+
+    static const size_t MANY_GROUP = 4;
+
+    // per-level buffers of one EvalFullMany walk, node 8 * k + i of a level belongs to keys[k]
+    struct ManyState
+    {
+        std::vector<std::vector<block>> sL, sR;
+        std::vector<std::vector<uint8_t>> tL, tR;
+        std::vector<block> wide_s, scratch, leaves; // 4 entries per node for the last two levels
+        std::vector<uint8_t> wide_t;
+        std::vector<uint8_t *> res;
+    };
+
+    // ExpandLevel over the nodes of num_keys keys, n / num_keys consecutive nodes per key
+    static void ExpandManyLevel(const Key *keys, size_t num_keys, size_t lvl, const block *s, const uint8_t *t, size_t n, block *scratch, block *next_s, uint8_t *next_t)
+    {
+        block *sL = scratch;
+        block *sR = scratch + n;
+        mAesFixedKey.encryptECB_MMO_Blocks2(mAesFixedKey2, s, n, sL, sR);
+        const size_t per_key = n / num_keys;
+        for (size_t k = num_keys; k-- > 0;)
+        {
+            const block sCW = keys[k].sCW[lvl];
+            const uint8_t tLCW = keys[k].tL(lvl), tRCW = keys[k].tR(lvl);
+            for (size_t i = (k + 1) * per_key; i-- > k * per_key;)
+            {
+                uint8_t ti = t[i];
+                block cw = sCW & _mm_set1_epi8(-ti);
+                next_t[2 * i] = getT(sL[i]) ^ (tLCW & ti);
+                next_t[2 * i + 1] = getT(sR[i]) ^ (tRCW & ti);
+                next_s[2 * i] = clr(sL[i]) ^ cw;
+                next_s[2 * i + 1] = clr(sR[i]) ^ cw;
+            }
+        }
+    }
+
+    static void EvalFullManyRecursive(const Key *keys, size_t num_keys, ManyState &st, const block *s, const uint8_t *t, size_t d, size_t lvl, size_t stop)
+    {
+        const size_t n = 8 * num_keys;
+        if (lvl + 2 == stop)
+        {
+            // the last two levels breadth first: the 4 leaves of node i land in leaves[4i..4i+3] and
+            // go out as one 64 byte store instead of 4 scattered ones
+            block *ws = st.wide_s.data();
+            uint8_t *wt = st.wide_t.data();
+            ExpandManyLevel(keys, num_keys, lvl, s, t, n, st.scratch.data(), ws, wt);
+            ExpandManyLevel(keys, num_keys, lvl + 1, ws, wt, 2 * n, st.scratch.data(), ws, wt);
+            block *leaves = st.leaves.data();
+            mAesFixedKey.encryptECBBlocks(ws, 4 * n, leaves);
+            for (size_t k = 0; k < n; k += 8)
+            {
+                const block CW = keys[k / 8].CW[0];
+                for (size_t i = 4 * k; i < 4 * (k + 8); i++)
+                {
+                    leaves[i] = leaves[i] ^ (CW & _mm_set1_epi8(-(wt[i])));
+                }
+                for (size_t i = k; i < k + 8; i++)
+                {
+                    memcpy(st.res[i], &leaves[4 * i], 4 * sizeof(block));
+                    st.res[i] += 4 * sizeof(block);
+                }
+            }
+            return;
+        }
+        if (lvl == stop)
+        {
+            block *leaves = st.leaves.data();
+            mAesFixedKey.encryptECBBlocks(s, n, leaves);
+            for (size_t k = 0; k < n; k += 8)
+            {
+                const block CW = keys[k / 8].CW[0];
+                for (size_t i = k; i < k + 8; i++)
+                {
+                    block leaf = leaves[i] ^ (CW & _mm_set1_epi8(-(t[i])));
+                    memcpy(st.res[i], &leaf, sizeof(block));
+                    st.res[i] += sizeof(block);
+                }
+            }
+            return;
+        }
+        block *sL = st.sL[d].data(), *sR = st.sR[d].data();
+        uint8_t *tL = st.tL[d].data(), *tR = st.tR[d].data();
+        prg::expand(s, n, sL, sR, tL, tR);
+        for (size_t k = 0; k < n; k += 8)
+        {
+            const Key &key = keys[k / 8];
+            const block sCW = key.sCW[lvl];
+            const uint8_t tLCW = key.tL(lvl), tRCW = key.tR(lvl);
+            for (size_t i = k; i < k + 8; i++)
+            {
+                block cw = sCW & _mm_set1_epi8(-(t[i]));
+                tL[i] ^= tLCW & t[i];
+                tR[i] ^= tRCW & t[i];
+                sL[i] ^= cw;
+                sR[i] ^= cw;
+            }
+        }
+        EvalFullManyRecursive(keys, num_keys, st, sL, tL, d + 1, lvl + 1, stop);
+        EvalFullManyRecursive(keys, num_keys, st, sR, tR, d + 1, lvl + 1, stop);
+    }
+
+    std::vector<std::vector<uint8_t>> EvalFullMany(const std::vector<Key> &keys, size_t logn, size_t num_threads)
+    {
+        assert(logn <= 63);
+        // wider leaves go one by one through EvalFullIterative, the 128-bit keys stay batched
+        bool wide = false;
+        for (const Key &key : keys)
+        {
+            wide |= key.leaf_bits != LEAF_BITS_128;
+        }
+        if (wide)
+        {
+            std::vector<std::vector<uint8_t>> data(keys.size());
+            std::vector<Key> narrow;
+            std::vector<size_t> narrow_index;
+            for (size_t k = 0; k < keys.size(); k++)
+            {
+                if (keys[k].leaf_bits != LEAF_BITS_128)
+                {
+                    data[k] = EvalFullIterative(keys[k], logn);
+                    continue;
+                }
+                narrow.push_back(keys[k]);
+                narrow_index.push_back(k);
+            }
+            if (narrow.empty())
+                return data;
+            std::vector<std::vector<uint8_t>> narrow_data = EvalFullMany(narrow, logn, num_threads);
+            for (size_t k = 0; k < narrow.size(); k++)
+            {
+                data[narrow_index[k]] = std::move(narrow_data[k]);
+            }
+            return data;
+        }
+        if (num_threads == 0)
+            num_threads = omp_get_max_threads();
+        size_t stop = logn >= 7 ? logn - 7 : 0; // pack 7 layers in final CW
+        assert(stop >= 3);                      // need 3 or more layers for this to make sense
+        // as in EvalFullParallel, a few groups of 8 subtrees per thread
+        size_t split_lvl = 3;
+        while ((1ULL << split_lvl) < 8 * 4 * num_threads && split_lvl < stop)
+        {
+            split_lvl++;
         }
 
-        lvl = 1;
-        block sLL = prg::getL(sL);
-        uint8_t tLL = getT(sLL);
-        sLL = clr(sLL);
-        block sRL = prg::getR(sL);
-        uint8_t tRL = getT(sRL);
-        sRL = clr(sRL);
-        if (tL)
-        {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
-            tLL ^= tLCW;
-            tRL ^= tRCW;
-            sLL ^= sCW;
-            sRL ^= sCW;
-        }
-        block sLR = prg::getL(sR);
-        uint8_t tLR = getT(sLR);
-        sLR = clr(sLR);
-        block sRR = prg::getR(sR);
-        uint8_t tRR = getT(sRR);
-        sRR = clr(sRR);
-        if (tR)
-        {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
-            tLR ^= tLCW;
-            tRR ^= tRCW;
-            sLR ^= sCW;
-            sRR ^= sCW;
-        }
-
-        lvl = 2;
-        block sLLL = prg::getL(sLL);
-        uint8_t tLLL = getT(sLLL);
-        sLLL = clr(sLLL);
-        block sRLL = prg::getR(sLL);
-        uint8_t tRLL = getT(sRLL);
-        sRLL = clr(sRLL);
-        if (tLL)
-        {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
-            tLLL ^= tLCW;
-            tRLL ^= tRCW;
-            sLLL ^= sCW;
-            sRLL ^= sCW;
-        }
-        block sLRL = prg::getL(sRL);
-        uint8_t tLRL = getT(sLRL);
-        sLRL = clr(sLRL);
-        block sRRL = prg::getR(sRL);
-        uint8_t tRRL = getT(sRRL);
-        sRRL = clr(sRRL);
-        if (tRL)
-        {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
-            tLRL ^= tLCW;
-            tRRL ^= tRCW;
-            sLRL ^= sCW;
-            sRRL ^= sCW;
-        }
-        block sLLR = prg::getL(sLR);
-        uint8_t tLLR = getT(sLLR);
-        sLLR = clr(sLLR);
-        block sRLR = prg::getR(sLR);
-        uint8_t tRLR = getT(sRLR);
-        sRLR = clr(sRLR);
-        if (tLR)
-        {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
-            tLLR ^= tLCW;
-            tRLR ^= tRCW;
-            sLLR ^= sCW;
-            sRLR ^= sCW;
-        }
-        block sLRR = prg::getL(sRR);
-        uint8_t tLRR = getT(sLRR);
-        sLRR = clr(sLRR);
-        block sRRR = prg::getR(sRR);
-        uint8_t tRRR = getT(sRRR);
-        sRRR = clr(sRRR);
-        if (tRR)
-        {
-            block sCW;
-            memcpy(&sCW, key.data() + 17 + lvl * 18, 16);
-            uint8_t tLCW = key.data()[17 + lvl * 18 + 16];
-            uint8_t tRCW = key.data()[17 + lvl * 18 + 17];
-            tLRR ^= tLCW;
-            tRRR ^= tRCW;
-            sLRR ^= sCW;
-            sRRR ^= sCW;
-        }
-        std::array<block, 8> s_array{sLLL, sRLL, sLRL, sRRL, sLLR, sRLR, sLRR, sRRR};
-        std::array<uint8_t, 8> t_array{tLLL, tRLL, tLRL, tRRL, tLLR, tRLR, tLRR, tRRR};
-
-        EvalFullRecursive8(key, s_array, t_array, 3, stop, data_ptrs);
+        const size_t num_keys = keys.size();
+        std::vector<std::vector<uint8_t>> data(num_keys);
+        if (num_keys == 0)
+            return data;
+        std::vector<std::vector<block>> top_s(num_keys);
+        std::vector<std::vector<uint8_t>> top_t(num_keys);
+        for (size_t k = 0; k < num_keys; k++)
+        {
+            assert(keys[k].leaf_bits == LEAF_BITS_128);
+            data[k].resize(1ULL << (logn - 3));
+            ExpandLevels(keys[k], split_lvl, top_s[k], top_t[k]);
+        }
+        const size_t subtree_bytes = 1ULL << (logn - 3 - split_lvl);
+        // keys are walked in lockstep groups of up to MANY_GROUP; wider groups spill the level
+        // buffers out of L1
+        const size_t group = std::min<size_t>(num_keys, MANY_GROUP);
+        const size_t n = 8 * group;
+        const size_t num_groups = (num_keys + group - 1) / group;
+        // clang-format off
+        #pragma omp parallel num_threads(num_threads)
+        {
+            ManyState st;
+            st.sL.assign(stop - split_lvl, std::vector<block>(n));
+            st.sR.assign(stop - split_lvl, std::vector<block>(n));
+            st.tL.assign(stop - split_lvl, std::vector<uint8_t>(n));
+            st.tR.assign(stop - split_lvl, std::vector<uint8_t>(n));
+            st.wide_s.resize(4 * n);
+            st.wide_t.resize(4 * n);
+            st.scratch.resize(4 * n);
+            st.leaves.resize(4 * n);
+            st.res.resize(n);
+            std::vector<block> s(n);
+            std::vector<uint8_t> t(n);
+            #pragma omp for schedule(dynamic) collapse(2)
+            for (size_t q = 0; q < num_groups; q++)
+            {
+                for (size_t g = 0; g < (1ULL << split_lvl); g += 8)
+                {
+                    const size_t first = q * group;
+                    const size_t m = std::min(group, num_keys - first);
+                    for (size_t k = 0; k < m; k++)
+                    {
+                        for (size_t i = 0; i < 8; i++)
+                        {
+                            s[8 * k + i] = top_s[first + k][g + i];
+                            t[8 * k + i] = top_t[first + k][g + i];
+                            st.res[8 * k + i] = &data[first + k][(g + i) * subtree_bytes];
+                        }
+                    }
+                    EvalFullManyRecursive(&keys[first], m, st, s.data(), t.data(), 0, split_lvl, stop);
+                }
+            }
+        }
+        // clang-format on
         return data;
     }
 
+    void EvalFullLeaves(const Key &key, size_t logn, size_t num_threads, const std::function<void(size_t, const block &)> &leaf)
+    {
+        assert(logn <= 63);
+        // wider leaves are streamed through EvalFullChunked on the calling thread, 128 bits at a time
+        if (key.leaf_bits != LEAF_BITS_128)
+        {
+            EvalFullChunked(key, logn, 1 << 16, [&](size_t offset, const uint8_t *data, size_t len)
+                            {
+                for (size_t i = 0; i < len; i += 16)
+                {
+                    block b;
+                    memcpy(&b, data + i, 16);
+                    leaf((offset + i) / 16, b);
+                } });
+            return;
+        }
+        size_t stop = logn >= 7 ? logn - 7 : 0; // pack 7 layers in final CW
+        assert(stop >= 3);                      // need 3 or more layers for this to make sense
+        size_t split_lvl = 3;
+        while ((1ULL << split_lvl) < 8 * 4 * num_threads && split_lvl < stop)
+        {
+            split_lvl++;
+        }
+
+        std::vector<block> s;
+        std::vector<uint8_t> t;
+        ExpandLevels(key, split_lvl, s, t);
+        const size_t subtree_leaves = 1ULL << (stop - split_lvl);
+        // clang-format off
+        #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+        for (size_t g = 0; g < s.size(); g += 8)
+        {
+            std::array<block, 8> s_array;
+            std::array<uint8_t, 8> t_array;
+            std::array<size_t, 8> leaf_index;
+            for (size_t i = 0; i < 8; i++)
+            {
+                s_array[i] = s[g + i];
+                t_array[i] = t[g + i];
+                leaf_index[i] = (g + i) * subtree_leaves;
+            }
+            auto forward = [&leaf, &leaf_index](int i, const block &b)
+            {
+                leaf(leaf_index[i]++, b);
+            };
+            EvalFullLeaves8(key, s_array, t_array, split_lvl, stop, forward);
+        }
+        // clang-format on
+    }
+
     //    std::vector<uint8_t> EvalFullNonRec(const std::vector<uint8_t>& key, size_t logn) {
     //        assert(logn <= 63);
     //        std::vector<uint8_t> data;
@@ -558,4 +1303,67 @@ namespace DPF
     //        }
     //        return data;
     //    }
+
+    // serialized keys are parsed once and forwarded
+
+    bool Eval(const std::vector<uint8_t> &key, size_t x, size_t logn)
+    {
+        return Eval(Key(key, logn), x, logn);
+    }
+
+    void EvalKeywords(const std::vector<uint8_t> &key, std::vector<size_t> hashs, size_t logn, std::vector<uint8_t> &results, size_t num_threads)
+    {
+        EvalKeywords(Key(key, logn), std::move(hashs), logn, results, num_threads);
+    }
+
+    void EvalPoints(const std::vector<uint8_t> &key, const std::vector<size_t> &sorted_points, size_t logn, std::vector<uint8_t> &results, size_t num_threads)
+    {
+        EvalPoints(Key(key, logn), sorted_points, logn, results, num_threads);
+    }
+
+    std::vector<uint8_t> EvalFull(const std::vector<uint8_t> &key, size_t logn)
+    {
+        return EvalFull(Key(key, logn), logn);
+    }
+
+    std::vector<uint8_t> EvalFull8(const std::vector<uint8_t> &key, size_t logn)
+    {
+        return EvalFull8(Key(key, logn), logn);
+    }
+
+    std::vector<uint8_t> EvalFullIterative(const std::vector<uint8_t> &key, size_t logn)
+    {
+        return EvalFullIterative(Key(key, logn), logn);
+    }
+
+    void EvalFullChunked(const std::vector<uint8_t> &key, size_t logn, size_t chunk_bytes, const std::function<void(size_t, const uint8_t *, size_t)> &chunk)
+    {
+        EvalFullChunked(Key(key, logn), logn, chunk_bytes, chunk);
+    }
+
+    std::vector<uint8_t> EvalFullParallel(const std::vector<uint8_t> &key, size_t logn, size_t num_threads, size_t split_lvl)
+    {
+        return EvalFullParallel(Key(key, logn), logn, num_threads, split_lvl);
+    }
+
+    std::vector<std::vector<uint8_t>> EvalFullMany(const std::vector<std::vector<uint8_t>> &keys, size_t logn, size_t num_threads)
+    {
+        std::vector<Key> parsed;
+        for (const auto &key : keys)
+        {
+            parsed.emplace_back(key, logn);
+        }
+        return EvalFullMany(parsed, logn, num_threads);
+    }
+
+    void EvalFullLeaves(const std::vector<uint8_t> &key, size_t logn, size_t num_threads, const std::function<void(size_t, const block &)> &leaf)
+    {
+        EvalFullLeaves(Key(key, logn), logn, num_threads, leaf);
+    }
+
+    template bool Eval<20>(const Key &key, size_t x);
+    template bool Eval<24>(const Key &key, size_t x);
+    template bool Eval<48>(const Key &key, size_t x);
+    template std::vector<uint8_t> EvalFull8<20>(const Key &key);
+    template std::vector<uint8_t> EvalFull8<24>(const Key &key);
 }
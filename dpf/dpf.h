@@ -2,13 +2,96 @@
 
 #include <cstdlib>
 #include <vector>
+#include <functional>
 #include "Defines.h"
 
 namespace DPF
 {
-    std::pair<std::vector<uint8_t>, std::vector<uint8_t>> Gen(size_t alpha, size_t logn);
+    // leaf widths: the final correction word packs the last leaf_bits levels of the tree into a
+    // 2^leaf_bits bit leaf, made of one fixed-key AES call per 128 bits of the leaf seed
+    const size_t LEAF_BITS_128 = 7;
+    const size_t LEAF_BITS_256 = 8;
+    const size_t LEAF_BITS_512 = 9;
+
+    // a Gen key parsed once: seed and t bit, the correction word seed of every level, the tL / tR
+    // correction bits of level lvl as bit lvl of tLCW / tRCW, and the final correction word, one
+    // block per 128 leaf bits. every evaluator taking the serialized key parses it into one of these.
+    // the key sizes of the leaf widths differ for the same logn, so logn tells them apart; without
+    // it the leaves are 128 bits
+    struct Key
+    {
+        block s0;
+        uint8_t t0;
+        std::vector<block> sCW;
+        uint64_t tLCW;
+        uint64_t tRCW;
+        size_t leaf_bits;
+        std::vector<block> CW;
+
+        explicit Key(const std::vector<uint8_t> &bytes, size_t logn = 0);
+        uint8_t tL(size_t lvl) const { return (tLCW >> lvl) & 1; }
+        uint8_t tR(size_t lvl) const { return (tRCW >> lvl) & 1; }
+    };
+
+    // Gen, Eval, EvalKeywords, EvalPoints, EvalFull, EvalFullIterative and EvalFullChunked take
+    // keys of every leaf width. EvalFull8, EvalFullParallel, EvalFullMany and EvalFullLeaves walk
+    // 128-bit keys only and hand wider ones to EvalFullIterative / EvalFullChunked; GenBatch and
+    // the compact format are 128-bit only, CompactKey returns an empty vector for any other key
+    std::pair<std::vector<uint8_t>, std::vector<uint8_t>> Gen(size_t alpha, size_t logn, size_t leaf_bits = LEAF_BITS_128);
+    // Gen for every alpha, advancing all keys level by level with one wide expansion per level and
+    // split over num_threads OpenMP threads (0 = default). unlike Gen, which uses the fixed test
+    // seed, every thread seeds its PRNG from std::random_device
+    std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> GenBatch(const std::vector<size_t> &alphas, size_t logn, size_t num_threads = 0);
+    // compact wire format for Gen keys: KEY_FORMAT_COMPACT, s0, the sCW of every level and
+    // the final CW, then a bitmap with t0 in bit 0 and tLCW / tRCW of level lvl in bits 1 + 2 * lvl
+    // and 2 + 2 * lvl
+    const uint8_t KEY_FORMAT_COMPACT = 0x02;
+    std::vector<uint8_t> CompactKey(const std::vector<uint8_t> &key, size_t logn);
+    // bytes of a Gen key for logn and of its compact form
+    size_t KeySize(size_t logn, size_t leaf_bits = LEAF_BITS_128);
+    size_t CompactKeySize(size_t logn);
+    // the Gen format of a key received in either format. the two differ in size for the same
+    // logn, so logn tells them apart; false if bytes is neither
+    bool DecodeKey(const std::vector<uint8_t> &bytes, size_t logn, std::vector<uint8_t> &key);
     bool Eval(const std::vector<uint8_t> &key, size_t x, size_t logn);
-    void EvalKeywords(const std::vector<uint8_t> &key, std::vector<size_t> hashs, size_t logn, std::vector<uint8_t> &results);
+    bool Eval(const Key &key, size_t x, size_t logn);
+    // num_threads = 0 uses the OpenMP default thread count
+    void EvalKeywords(const std::vector<uint8_t> &key, std::vector<size_t> hashs, size_t logn, std::vector<uint8_t> &results, size_t num_threads = 0);
+    void EvalKeywords(const Key &key, std::vector<size_t> hashs, size_t logn, std::vector<uint8_t> &results, size_t num_threads = 0);
+    // same output as EvalKeywords, but sorted_points must be in ascending order so that
+    // shared tree prefixes are expanded only once
+    void EvalPoints(const std::vector<uint8_t> &key, const std::vector<size_t> &sorted_points, size_t logn, std::vector<uint8_t> &results, size_t num_threads = 0);
+    void EvalPoints(const Key &key, const std::vector<size_t> &sorted_points, size_t logn, std::vector<uint8_t> &results, size_t num_threads = 0);
     std::vector<uint8_t> EvalFull(const std::vector<uint8_t> &key, size_t logn);
+    std::vector<uint8_t> EvalFull(const Key &key, size_t logn);
     std::vector<uint8_t> EvalFull8(const std::vector<uint8_t> &key, size_t logn);
+    std::vector<uint8_t> EvalFull8(const Key &key, size_t logn);
+    // Eval and EvalFull8 with the depth fixed at compile time, so that the level loop unrolls and
+    // the recursion is laid out statically. instantiated for LOGN 20, 24 and 48 (EvalFull8: 20
+    // and 24); the runtime-logn versions, including EvalKeywords, dispatch to them by table
+    template <size_t LOGN>
+    bool Eval(const Key &key, size_t x);
+    template <size_t LOGN>
+    std::vector<uint8_t> EvalFull8(const Key &key);
+    // same output as EvalFull8, expanded level by level with one wide AES call per level and
+    // child side instead of recursing; logn >= leaf_bits
+    std::vector<uint8_t> EvalFullIterative(const std::vector<uint8_t> &key, size_t logn);
+    std::vector<uint8_t> EvalFullIterative(const Key &key, size_t logn);
+    // EvalFullIterative streamed: chunk(offset, data, len) receives bytes offset .. offset+len-1 of
+    // the EvalFull8 output in order, len being the largest power of two <= chunk_bytes (at least one
+    // leaf, at most the domain). only O(chunk_bytes) is allocated however large logn is; logn >= leaf_bits
+    void EvalFullChunked(const std::vector<uint8_t> &key, size_t logn, size_t chunk_bytes, const std::function<void(size_t, const uint8_t *, size_t)> &chunk);
+    void EvalFullChunked(const Key &key, size_t logn, size_t chunk_bytes, const std::function<void(size_t, const uint8_t *, size_t)> &chunk);
+    // EvalFull8 on num_threads threads: the tree is split at depth split_lvl (0 picks one from
+    // num_threads) and every subtree writes its own slice of the output
+    std::vector<uint8_t> EvalFullParallel(const std::vector<uint8_t> &key, size_t logn, size_t num_threads, size_t split_lvl = 0);
+    std::vector<uint8_t> EvalFullParallel(const Key &key, size_t logn, size_t num_threads, size_t split_lvl = 0);
+    // EvalFull8 of every key, the trees walked in lockstep so that each level is one PRG call over
+    // 8 nodes of every key; groups of 8 subtrees of all keys go to num_threads threads (0 = default)
+    std::vector<std::vector<uint8_t>> EvalFullMany(const std::vector<std::vector<uint8_t>> &keys, size_t logn, size_t num_threads = 0);
+    std::vector<std::vector<uint8_t>> EvalFullMany(const std::vector<Key> &keys, size_t logn, size_t num_threads = 0);
+    // full-domain evaluation without materializing the result: leaf(i, b) receives the selection
+    // bits of points i*128 .. i*128+127 in b, called concurrently from num_threads OpenMP threads
+    void EvalFullLeaves(const std::vector<uint8_t> &key, size_t logn, size_t num_threads, const std::function<void(size_t, const block &)> &leaf);
+    void EvalFullLeaves(const Key &key, size_t logn, size_t num_threads, const std::function<void(size_t, const block &)> &leaf);
 }
@@ -1,6 +1,27 @@
 #include "hashdatastore.h"
+#include "dpf.h"
 #include <cassert>
 #include "omp.h"
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <functional>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <tuple>
 
 const hashdatastore::hash_type precomputed_masks[256][8] = {
     {
@@ -5646,3 +5667,1188 @@ hashdatastore::hash_type hashdatastore::answer_pir_idea_speed_comparison(const s
     result = _mm256_xor_si256(result, results[7]);
     return result;
 }
+
+void hashdatastore::sort_by_hash()
+{
+    assert(records_.empty() && !mapping_);
+    std::vector<size_t> perm(hashs_.size());
+    std::iota(perm.begin(), perm.end(), 0);
+    std::stable_sort(perm.begin(), perm.end(), [this](size_t a, size_t b)
+                     { return hashs_[a] < hashs_[b]; });
+
+    std::vector<size_t> sorted_hashs(hashs_.size());
+    for (size_t i = 0; i < perm.size(); i++)
+    {
+        sorted_hashs[i] = hashs_[perm[i]];
+    }
+    hashs_.swap(sorted_hashs);
+
+    for (size_t j = 0; j < data_s.size(); j++)
+    {
+        assert(data_s[j].size() == perm.size());
+        std::vector<hash_type, HashTypeAllocator> sorted_data(perm.size());
+        for (size_t i = 0; i < perm.size(); i++)
+        {
+            sorted_data[i] = data_s[j][perm[i]];
+        }
+        data_s[j].swap(sorted_data);
+    }
+}
+
+std::vector<size_t> hashdatastore::size_classes(const std::vector<size_t> &widths, std::vector<size_t> &record_class, size_t overhead_bytes)
+{
+    // records per distinct width, every record takes at least one slice
+    std::map<size_t, size_t> counts;
+    for (size_t w : widths)
+    {
+        counts[std::max<size_t>(w, 1)]++;
+    }
+    std::vector<size_t> distinct, count;
+    for (const auto &c : counts)
+    {
+        distinct.push_back(c.first);
+        count.push_back(c.second);
+    }
+
+    // cost[j]: least bytes scanned (plus overhead_bytes per class) for the first j widths, whose
+    // last class starts at width first[j]. a class pads its rows to a multiple of 8
+    const size_t k = distinct.size();
+    std::vector<size_t> cost(k + 1, std::numeric_limits<size_t>::max()), first(k + 1, 0);
+    cost[0] = 0;
+    for (size_t j = 1; j <= k; j++)
+    {
+        size_t rows = 0;
+        for (size_t i = j; i-- > 0;)
+        {
+            rows += count[i];
+            size_t c = cost[i] + ((rows + 7) & ~static_cast<size_t>(7)) * distinct[j - 1] * sizeof(hash_type) + overhead_bytes;
+            if (c < cost[j])
+            {
+                cost[j] = c;
+                first[j] = i;
+            }
+        }
+    }
+
+    std::vector<size_t> class_widths;
+    std::map<size_t, size_t> width_class;
+    std::vector<size_t> ends;
+    for (size_t j = k; j > 0; j = first[j])
+    {
+        ends.push_back(j);
+    }
+    for (size_t e = ends.size(); e-- > 0;)
+    {
+        size_t j = ends[e];
+        for (size_t i = first[j]; i < j; i++)
+        {
+            width_class[distinct[i]] = class_widths.size();
+        }
+        class_widths.push_back(distinct[j - 1]);
+    }
+    record_class.resize(widths.size());
+    for (size_t r = 0; r < widths.size(); r++)
+    {
+        record_class[r] = width_class[std::max<size_t>(widths[r], 1)];
+    }
+    return class_widths;
+}
+
+static uint64_t mix64(uint64_t x)
+{
+    // splitmix64 finalizer
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+size_t hashdatastore::cuckoo_bucket(const std::string &keyword, size_t hash_id, size_t logn)
+{
+    uint64_t h = mix64(std::hash<std::string>()(keyword) + (hash_id + 1) * 0x9E3779B97F4A7C15ULL);
+    // DPF::Gen cannot address the last point of the domain, so the last bucket stays unused
+    return h % ((1ULL << logn) - 1);
+}
+
+uint64_t hashdatastore::cuckoo_fingerprint(const std::string &keyword)
+{
+    // never 0, which marks an empty bucket
+    return mix64(std::hash<std::string>()(keyword) ^ 0xA5A5A5A5A5A5A5A5ULL) | 1;
+}
+
+bool hashdatastore::build_cuckoo(const std::vector<std::string> &keywords, const std::vector<std::vector<std::string>> &data_str_s, size_t num_slice, size_t logn)
+{
+    assert(keywords.size() == data_str_s.size());
+    const size_t num_buckets = 1ULL << logn;
+    const size_t empty = SIZE_MAX;
+    const size_t max_kicks = 500;
+    std::vector<size_t> table(num_buckets, empty);
+    // fixed seed: both servers have to end up with the same placement
+    std::minstd_rand rng(logn);
+    for (size_t i = 0; i < keywords.size(); i++)
+    {
+        size_t item = i;
+        size_t kicks = 0;
+        while (item != empty)
+        {
+            for (size_t h = 0; h < CUCKOO_NUM_HASH && item != empty; h++)
+            {
+                size_t b = cuckoo_bucket(keywords[item], h, logn);
+                if (table[b] == empty)
+                {
+                    table[b] = item;
+                    item = empty;
+                }
+            }
+            if (item == empty)
+                break;
+            if (kicks++ == max_kicks)
+                return false;
+            // random walk: evict the occupant of a random candidate bucket
+            size_t b = cuckoo_bucket(keywords[item], rng() % CUCKOO_NUM_HASH, logn);
+            std::swap(item, table[b]);
+        }
+    }
+
+    hashs_.clear();
+    records_.clear();
+    mapping_.reset();
+    data_s.assign(num_slice + 1, std::vector<hash_type, HashTypeAllocator>(num_buckets, _mm256_setzero_si256()));
+    for (size_t b = 0; b < num_buckets; b++)
+    {
+        if (table[b] == empty)
+            continue;
+        for (size_t j = 0; j < num_slice; j++)
+        {
+            data_s[j][b] = string2m256i(data_str_s[table[b]][j]);
+        }
+        data_s[num_slice][b] = _mm256_set_epi64x(0, 0, 0, cuckoo_fingerprint(keywords[table[b]]));
+    }
+    return true;
+}
+
+// answer_pir2 over num_rows rows starting at data, indexing holds the selection bits of exactly those rows
+static inline hashdatastore::hash_type answer_rows(const hashdatastore::hash_type *data, size_t num_rows, const uint8_t *indexing)
+{
+    hashdatastore::hash_type result = _mm256_set_epi64x(0, 0, 0, 0);
+    hashdatastore::hash_type results[8] = {
+        {result},
+        {result},
+        {result},
+        {result},
+        {result},
+        {result},
+        {result},
+        {result},
+    };
+    for (size_t i = 0; i < num_rows; i += 8)
+    {
+        uint64_t tmp = indexing[i / 8];
+        results[0] = _mm256_xor_si256(results[0], _mm256_and_si256(data[i + 0], _mm256_set1_epi64x(-((tmp >> 0) & 1))));
+        results[1] = _mm256_xor_si256(results[1], _mm256_and_si256(data[i + 1], _mm256_set1_epi64x(-((tmp >> 1) & 1))));
+        results[2] = _mm256_xor_si256(results[2], _mm256_and_si256(data[i + 2], _mm256_set1_epi64x(-((tmp >> 2) & 1))));
+        results[3] = _mm256_xor_si256(results[3], _mm256_and_si256(data[i + 3], _mm256_set1_epi64x(-((tmp >> 3) & 1))));
+        results[4] = _mm256_xor_si256(results[4], _mm256_and_si256(data[i + 4], _mm256_set1_epi64x(-((tmp >> 4) & 1))));
+        results[5] = _mm256_xor_si256(results[5], _mm256_and_si256(data[i + 5], _mm256_set1_epi64x(-((tmp >> 5) & 1))));
+        results[6] = _mm256_xor_si256(results[6], _mm256_and_si256(data[i + 6], _mm256_set1_epi64x(-((tmp >> 6) & 1))));
+        results[7] = _mm256_xor_si256(results[7], _mm256_and_si256(data[i + 7], _mm256_set1_epi64x(-((tmp >> 7) & 1))));
+    }
+
+    result = _mm256_xor_si256(results[0], results[1]);
+    result = _mm256_xor_si256(result, results[2]);
+    result = _mm256_xor_si256(result, results[3]);
+    result = _mm256_xor_si256(result, results[4]);
+    result = _mm256_xor_si256(result, results[5]);
+    result = _mm256_xor_si256(result, results[6]);
+    result = _mm256_xor_si256(result, results[7]);
+    return result;
+}
+
+// answer_rows with the eight masks of a selection byte taken from precomputed_masks (answer_pir5)
+static hashdatastore::hash_type answer_rows_table(const hashdatastore::hash_type *data, size_t num_rows, const uint8_t *indexing)
+{
+    hashdatastore::hash_type results[8];
+    for (int j = 0; j < 8; j++)
+    {
+        results[j] = _mm256_setzero_si256();
+    }
+    for (size_t i = 0; i < num_rows; i += 8)
+    {
+        const hashdatastore::hash_type *masks = precomputed_masks[indexing[i / 8]];
+        for (int j = 0; j < 8; j++)
+        {
+            results[j] = _mm256_xor_si256(results[j], _mm256_and_si256(data[i + j], masks[j]));
+        }
+    }
+    for (int j = 1; j < 8; j++)
+    {
+        results[0] = _mm256_xor_si256(results[0], results[j]);
+    }
+    return results[0];
+}
+
+// answer_rows with masked loads (answer_pir3): the selection bit of row j is moved into the sign
+// bit of every 64-bit element, unselected rows are never read
+static hashdatastore::hash_type answer_rows_maskload(const hashdatastore::hash_type *data, size_t num_rows, const uint8_t *indexing)
+{
+    hashdatastore::hash_type results[8];
+    for (int j = 0; j < 8; j++)
+    {
+        results[j] = _mm256_setzero_si256();
+    }
+    for (size_t i = 0; i < num_rows; i += 8)
+    {
+        __m256i x = _mm256_set1_epi64x(static_cast<uint64_t>(indexing[i / 8]) << 56);
+        for (int j = 7; j >= 0; j--)
+        {
+            results[j] = _mm256_xor_si256(results[j], _mm256_maskload_epi64((const long long int *)&data[i + j], x));
+            x = _mm256_slli_epi64(x, 1);
+        }
+    }
+    for (int j = 1; j < 8; j++)
+    {
+        results[0] = _mm256_xor_si256(results[0], results[j]);
+    }
+    return results[0];
+}
+
+// bytes the *_PREFETCH kernels fetch ahead of the row they read, 0 turns the prefetch off
+static size_t gPrefetchDistance = 2048;
+
+// prefetches the cache lines of [p, p + bytes) with the non-temporal hint: a scan reads every row
+// once per query, so it should not evict what the other queries keep in the caches
+static inline void prefetch_nta(const void *p, size_t bytes)
+{
+    for (size_t offset = 0; offset < bytes; offset += 64)
+    {
+        _mm_prefetch(static_cast<const char *>(p) + offset, _MM_HINT_NTA);
+    }
+}
+
+// aligned load of a row, a streaming (movntdqa) one in the prefetch kernels
+template <bool Stream>
+static inline hashdatastore::hash_type load_row(const hashdatastore::hash_type *p)
+{
+    return Stream ? _mm256_stream_load_si256(p) : _mm256_load_si256(p);
+}
+
+// answer_rows with every group of 8 rows prefetched gPrefetchDistance bytes ahead and read with
+// streaming loads
+static hashdatastore::hash_type answer_rows_prefetch(const hashdatastore::hash_type *data, size_t num_rows, const uint8_t *indexing)
+{
+    const size_t distance = gPrefetchDistance;
+    const char *ahead = reinterpret_cast<const char *>(data) + distance;
+    hashdatastore::hash_type results[8];
+    for (int j = 0; j < 8; j++)
+    {
+        results[j] = _mm256_setzero_si256();
+    }
+    for (size_t i = 0; i < num_rows; i += 8)
+    {
+        if (distance)
+            prefetch_nta(ahead + i * sizeof(hashdatastore::hash_type), 8 * sizeof(hashdatastore::hash_type));
+        uint64_t tmp = indexing[i / 8];
+#pragma GCC unroll 8
+        for (int j = 0; j < 8; j++)
+        {
+            results[j] = _mm256_xor_si256(results[j], _mm256_and_si256(load_row<true>(data + i + j), _mm256_set1_epi64x(-((tmp >> j) & 1))));
+        }
+    }
+    for (int j = 1; j < 8; j++)
+    {
+        results[0] = _mm256_xor_si256(results[0], results[j]);
+    }
+    return results[0];
+}
+
+// answer_rows for record-major rows of row_stride hash_types: every row's mask is applied to
+// W consecutive slices kept in registers, acc[j] collects slice j
+template <size_t W, bool Prefetch>
+static inline void answer_records(const hashdatastore::hash_type *data, size_t row_stride, size_t num_rows, const uint8_t *indexing, hashdatastore::hash_type *acc)
+{
+    const size_t distance = Prefetch ? gPrefetchDistance : 0;
+    hashdatastore::hash_type results[W];
+    for (size_t j = 0; j < W; j++)
+    {
+        results[j] = acc[j];
+    }
+    for (size_t i = 0; i < num_rows; i++)
+    {
+        hashdatastore::hash_type mask = _mm256_set1_epi64x(-((indexing[i / 8] >> (i % 8)) & 1));
+        const hashdatastore::hash_type *row = data + i * row_stride;
+        if (distance)
+            prefetch_nta(reinterpret_cast<const char *>(row) + distance, W * sizeof(hashdatastore::hash_type));
+        for (size_t j = 0; j < W; j++)
+        {
+            results[j] = _mm256_xor_si256(results[j], _mm256_and_si256(load_row<Prefetch>(row + j), mask));
+        }
+    }
+    for (size_t j = 0; j < W; j++)
+    {
+        acc[j] = results[j];
+    }
+}
+
+#define ANSWER_TARGET_AVX512 __attribute__((target("avx512f,bmi2")))
+
+// the lane masks of 16 rows in one word: byte j masks the 512-bit lane of rows 2j and 2j + 1,
+// every selection bit spread over the four 64-bit elements of its row
+ANSWER_TARGET_AVX512 static inline uint64_t row_pair_masks(uint64_t bits)
+{
+    return _pdep_u64(bits, 0x1111111111111111ULL) * 0xF;
+}
+
+// two hash_types to one 512-bit lane and back. staged through memory rather than the 256-bit
+// insert/extract intrinsics, whose undefined pass-through operands trip -Wuninitialized at -O2
+ANSWER_TARGET_AVX512 static inline __m512i load_pair(const hashdatastore::hash_type *lo, const hashdatastore::hash_type *hi)
+{
+    alignas(64) hashdatastore::hash_type pair[2] = {*lo, *hi};
+    return _mm512_load_si512(pair);
+}
+
+ANSWER_TARGET_AVX512 static inline void store_pair(__m512i value, hashdatastore::hash_type *lo, hashdatastore::hash_type *hi)
+{
+    alignas(64) hashdatastore::hash_type pair[2];
+    _mm512_store_si512(pair, value);
+    *lo = pair[0];
+    if (hi)
+        *hi = pair[1];
+}
+
+// answer_rows with two rows per 512-bit lane, XORed in under mask registers. the prefetch kernel
+// only adds the prefetch: slices are 32-byte aligned, too little for 512-bit streaming loads
+template <bool Prefetch>
+ANSWER_TARGET_AVX512 static hashdatastore::hash_type answer_rows512(const hashdatastore::hash_type *data, size_t num_rows, const uint8_t *indexing)
+{
+    const size_t distance = Prefetch ? gPrefetchDistance : 0;
+    const char *ahead = reinterpret_cast<const char *>(data) + distance;
+    __m512i results[8];
+    for (int j = 0; j < 8; j++)
+    {
+        results[j] = _mm512_setzero_si512();
+    }
+    size_t i = 0;
+    for (; i + 16 <= num_rows; i += 16)
+    {
+        if (distance)
+            prefetch_nta(ahead + i * sizeof(hashdatastore::hash_type), 16 * sizeof(hashdatastore::hash_type));
+        uint16_t bits;
+        memcpy(&bits, indexing + i / 8, sizeof(bits));
+        uint64_t masks = row_pair_masks(bits);
+#pragma GCC unroll 8
+        for (int j = 0; j < 8; j++)
+        {
+            results[j] = _mm512_mask_xor_epi64(results[j], (__mmask8)(masks >> (8 * j)), results[j], _mm512_loadu_si512(data + i + 2 * j));
+        }
+    }
+    // num_rows is a multiple of 8
+    if (i < num_rows)
+    {
+        uint64_t masks = row_pair_masks(indexing[i / 8]);
+        for (int j = 0; j < 4; j++)
+        {
+            results[j] = _mm512_mask_xor_epi64(results[j], (__mmask8)(masks >> (8 * j)), results[j], _mm512_loadu_si512(data + i + 2 * j));
+        }
+    }
+    __m512i result = results[0];
+    for (int j = 1; j < 8; j++)
+    {
+        result = _mm512_xor_si512(result, results[j]);
+    }
+    hashdatastore::hash_type lo, hi;
+    store_pair(result, &lo, &hi);
+    return _mm256_xor_si256(lo, hi);
+}
+
+// answer_records with two slices per 512-bit lane. records of two or more slices have an even
+// row_stride, so the lane of an odd last slice takes the padding slot along, which is dropped
+template <size_t W, bool Prefetch>
+ANSWER_TARGET_AVX512 static inline void answer_records512(const hashdatastore::hash_type *data, size_t row_stride, size_t num_rows, const uint8_t *indexing, hashdatastore::hash_type *acc)
+{
+    const size_t distance = Prefetch ? gPrefetchDistance : 0;
+    const size_t Z = (W + 1) / 2;
+    const hashdatastore::hash_type zero = _mm256_setzero_si256();
+    __m512i results[Z];
+    for (size_t z = 0; z < Z; z++)
+    {
+        results[z] = load_pair(&acc[2 * z], 2 * z + 1 < W ? &acc[2 * z + 1] : &zero);
+    }
+    for (size_t i = 0; i < num_rows; i++)
+    {
+        __mmask8 mask = -((indexing[i / 8] >> (i % 8)) & 1);
+        const hashdatastore::hash_type *row = data + i * row_stride;
+        if (distance)
+            prefetch_nta(reinterpret_cast<const char *>(row) + distance, W * sizeof(hashdatastore::hash_type));
+        for (size_t z = 0; z < Z; z++)
+        {
+            results[z] = _mm512_mask_xor_epi64(results[z], mask, results[z], _mm512_loadu_si512(row + 2 * z));
+        }
+    }
+    for (size_t z = 0; z < Z; z++)
+    {
+        store_pair(results[z], &acc[2 * z], 2 * z + 1 < W ? &acc[2 * z + 1] : nullptr);
+    }
+}
+
+// answer_slices on the AVX-512 kernels
+template <bool Prefetch>
+ANSWER_TARGET_AVX512 static void answer_slices512(const hashdatastore::slice_table &table, size_t first_slice, size_t count, size_t row, size_t num_rows, const uint8_t *indexing, hashdatastore::hash_type *acc)
+{
+    if (table.row_stride == 1)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            acc[j] = _mm256_xor_si256(acc[j], answer_rows512<Prefetch>(table.slices[first_slice + j] + row, num_rows, indexing));
+        }
+        return;
+    }
+    const hashdatastore::hash_type *data = table.slices[first_slice] + row * table.row_stride;
+    switch (count)
+    {
+    case 2: answer_records512<2, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 3: answer_records512<3, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 4: answer_records512<4, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 5: answer_records512<5, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 6: answer_records512<6, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 7: answer_records512<7, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 8: answer_records512<8, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    }
+    for (size_t i = 0; i < num_rows; i++)
+    {
+        uint64_t bit = (indexing[i / 8] >> (i % 8)) & 1;
+        __mmask8 mask = -bit;
+        const hashdatastore::hash_type *record = data + i * table.row_stride;
+        if (Prefetch && gPrefetchDistance)
+            prefetch_nta(reinterpret_cast<const char *>(record) + gPrefetchDistance, count * sizeof(hashdatastore::hash_type));
+        size_t j = 0;
+        for (; j + 2 <= count; j += 2)
+        {
+            __m512i pair = load_pair(&acc[j], &acc[j + 1]);
+            pair = _mm512_mask_xor_epi64(pair, mask, pair, _mm512_loadu_si512(record + j));
+            store_pair(pair, &acc[j], &acc[j + 1]);
+        }
+        if (j < count)
+            acc[j] = _mm256_xor_si256(acc[j], _mm256_and_si256(record[j], _mm256_set1_epi64x(-bit)));
+    }
+}
+
+// answer_slices on the AVX2 kernels: slice-major tables go through Rows, record-major ones share
+// the register-resident record loops
+template <hashdatastore::hash_type (*Rows)(const hashdatastore::hash_type *, size_t, const uint8_t *), bool Prefetch>
+static void answer_slices256(const hashdatastore::slice_table &table, size_t first_slice, size_t count, size_t row, size_t num_rows, const uint8_t *indexing, hashdatastore::hash_type *acc)
+{
+    if (table.row_stride == 1)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            acc[j] = _mm256_xor_si256(acc[j], Rows(table.slices[first_slice + j] + row, num_rows, indexing));
+        }
+        return;
+    }
+    // record-major: narrow records keep their accumulators in registers, wide ones are walked
+    // row by row with the accumulators in L1
+    const hashdatastore::hash_type *data = table.slices[first_slice] + row * table.row_stride;
+    switch (count)
+    {
+    case 1: answer_records<1, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 2: answer_records<2, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 3: answer_records<3, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 4: answer_records<4, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 5: answer_records<5, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 6: answer_records<6, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 7: answer_records<7, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    case 8: answer_records<8, Prefetch>(data, table.row_stride, num_rows, indexing, acc); return;
+    }
+    for (size_t i = 0; i < num_rows; i++)
+    {
+        hashdatastore::hash_type mask = _mm256_set1_epi64x(-((indexing[i / 8] >> (i % 8)) & 1));
+        const hashdatastore::hash_type *record = data + i * table.row_stride;
+        if (Prefetch && gPrefetchDistance)
+            prefetch_nta(reinterpret_cast<const char *>(record) + gPrefetchDistance, count * sizeof(hashdatastore::hash_type));
+        for (size_t j = 0; j < count; j++)
+        {
+            acc[j] = _mm256_xor_si256(acc[j], _mm256_and_si256(load_row<Prefetch>(record + j), mask));
+        }
+    }
+}
+
+// answers slices [first_slice, first_slice + count) over num_rows rows starting at row,
+// acc[j] collects slice first_slice + j
+typedef void (*answer_slices_fn)(const hashdatastore::slice_table &table, size_t first_slice, size_t count, size_t row, size_t num_rows, const uint8_t *indexing, hashdatastore::hash_type *acc);
+
+// kernel registry, indexed by hashdatastore::Kernel. record_major is false for kernels that answer
+// record-major tables with the avx2 loops, the autotuner does not time those twice
+struct answer_kernel
+{
+    const char *name;
+    answer_slices_fn slices;
+    bool record_major;
+};
+
+static const answer_kernel answer_kernels[hashdatastore::NUM_KERNELS] = {
+    {"avx2", answer_slices256<answer_rows, false>, true},
+    {"avx512", answer_slices512<false>, true},
+    {"avx2-table", answer_slices256<answer_rows_table, false>, false},
+    {"avx2-maskload", answer_slices256<answer_rows_maskload, false>, false},
+    {"avx2-prefetch", answer_slices256<answer_rows_prefetch, true>, true},
+    {"avx512-prefetch", answer_slices512<true>, true},
+};
+
+static bool cpuSupports(hashdatastore::Kernel kernel)
+{
+    switch (kernel)
+    {
+    case hashdatastore::KERNEL_AVX512:
+    case hashdatastore::KERNEL_AVX512_PREFETCH:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("bmi2");
+    case hashdatastore::NUM_KERNELS:
+        return false;
+    default:
+        return __builtin_cpu_supports("avx2");
+    }
+}
+
+static hashdatastore::Kernel detectKernel()
+{
+    if (cpuSupports(hashdatastore::KERNEL_AVX512))
+        return hashdatastore::KERNEL_AVX512;
+    return hashdatastore::KERNEL_AVX2;
+}
+
+static hashdatastore::Kernel gAnswerKernel = detectKernel();
+
+// kernels pinned by autotune, keyed by (record-major, slices per record, threads)
+typedef std::tuple<bool, size_t, size_t> tune_key;
+static std::mutex gTunedMutex;
+static std::map<tune_key, hashdatastore::Kernel> gTunedKernels;
+
+hashdatastore::Kernel hashdatastore::kernel()
+{
+    return gAnswerKernel;
+}
+
+hashdatastore::Kernel hashdatastore::kernel(bool record_major, size_t num_slice, size_t num_threads)
+{
+    std::lock_guard<std::mutex> lock(gTunedMutex);
+    auto it = gTunedKernels.find(tune_key(record_major, num_slice, num_threads));
+    return it == gTunedKernels.end() ? gAnswerKernel : it->second;
+}
+
+bool hashdatastore::supports(Kernel kernel)
+{
+    return cpuSupports(kernel);
+}
+
+bool hashdatastore::setKernel(Kernel kernel)
+{
+    if (!cpuSupports(kernel))
+        return false;
+    std::lock_guard<std::mutex> lock(gTunedMutex);
+    gAnswerKernel = kernel;
+    gTunedKernels.clear();
+    return true;
+}
+
+size_t hashdatastore::prefetchDistance()
+{
+    return gPrefetchDistance;
+}
+
+void hashdatastore::setPrefetchDistance(size_t bytes)
+{
+    gPrefetchDistance = bytes;
+}
+
+const char *hashdatastore::kernelName(Kernel kernel)
+{
+    return kernel < NUM_KERNELS ? answer_kernels[kernel].name : "unknown";
+}
+
+static hashdatastore::Kernel tuned_kernel(const hashdatastore::slice_table &table, size_t num_threads)
+{
+    return hashdatastore::kernel(table.row_stride != 1, table.slices.size(), num_threads);
+}
+
+hashdatastore::Kernel hashdatastore::autotune(size_t num_threads, std::ostream *log, size_t sample_bytes) const
+{
+    slice_table table = slice_pointers();
+    const bool record_major = table.row_stride != 1;
+    const size_t num_slice = table.slices.size();
+    if (num_slice == 0 || table.num_rows < 8)
+        return kernel(record_major, num_slice, num_threads);
+
+    // the first rows of the table, whole selection bytes
+    const size_t row_bytes = sizeof(hash_type) * (record_major ? table.row_stride : num_slice);
+    table.num_rows = std::min(table.num_rows, std::max<size_t>(8, sample_bytes / row_bytes)) & ~static_cast<size_t>(7);
+    // a partitioned table is cut to the sample as well, its later ranges end up empty
+    for (size_t &boundary : table.partitions)
+    {
+        boundary = std::min(boundary, table.num_rows);
+    }
+    std::vector<uint8_t> indexing(table.num_rows / 8);
+    for (size_t i = 0; i < indexing.size(); i++)
+    {
+        indexing[i] = mix64(i);
+    }
+    const std::vector<const std::vector<uint8_t> *> indexings = {&indexing};
+
+    // every kernel is checked against avx2, then timed as the best of a few passes; the passes
+    // take turns between kernels so that warm-up and clock changes do not favour one of them
+    const size_t TUNE_REPS = 5;
+    std::vector<hash_type, HashTypeAllocator> expected(num_slice), answer(num_slice);
+    answer_pir_batch(table, indexings, num_threads, KERNEL_AVX2, expected.data());
+    std::vector<Kernel> candidates;
+    std::ostringstream timings;
+    for (size_t k = 0; k < NUM_KERNELS; k++)
+    {
+        Kernel candidate = static_cast<Kernel>(k);
+        if (!cpuSupports(candidate) || (record_major && !answer_kernels[k].record_major))
+            continue;
+        answer_pir_batch(table, indexings, num_threads, candidate, answer.data());
+        if (memcmp(answer.data(), expected.data(), num_slice * sizeof(hash_type)) == 0)
+            candidates.push_back(candidate);
+        else
+            timings << answer_kernels[k].name << " wrong answer, ";
+    }
+    std::vector<double> times(candidates.size(), std::numeric_limits<double>::infinity());
+    for (size_t r = 0; r < TUNE_REPS; r++)
+    {
+        for (size_t c = 0; c < candidates.size(); c++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            answer_pir_batch(table, indexings, num_threads, candidates[c], answer.data());
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            times[c] = std::min(times[c], elapsed.count());
+        }
+    }
+    Kernel best = KERNEL_AVX2;
+    double best_time = std::numeric_limits<double>::infinity();
+    for (size_t c = 0; c < candidates.size(); c++)
+    {
+        timings << answer_kernels[candidates[c]].name << " " << times[c] * 1e3 << " ms, ";
+        if (times[c] < best_time)
+        {
+            best = candidates[c];
+            best_time = times[c];
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(gTunedMutex);
+        gTunedKernels[tune_key(record_major, num_slice, num_threads)] = best;
+    }
+    if (log)
+        *log << "Answer kernel for " << (record_major ? "record-major" : "slice-major") << ", " << num_slice << " slices, "
+             << num_threads << " threads: " << answer_kernels[best].name << " (" << timings.str() << table.num_rows << " rows)" << std::endl;
+    return best;
+}
+
+void hashdatastore::answer_pir_fused(const slice_table &table, const std::vector<uint8_t> &key, size_t logn, size_t num_threads, hash_type *answer) const
+{
+    assert(table.num_rows % 8 == 0);
+    const size_t num_slice = table.slices.size();
+    // per-thread partial answers, padded so that no two threads share a cache line
+    const size_t stride = (num_slice + 3) & ~static_cast<size_t>(1);
+    std::vector<hash_type, HashTypeAllocator> partial(num_threads * stride, _mm256_setzero_si256());
+    const answer_slices_fn slices = answer_kernels[tuned_kernel(table, num_threads)].slices;
+    DPF::EvalFullLeaves(key, logn, num_threads, [&](size_t leaf, const block &bits)
+                        {
+        size_t first = leaf * 128;
+        if (first >= table.num_rows)
+            return;
+        size_t n = std::min<size_t>(128, table.num_rows - first);
+        alignas(16) uint8_t indexing[16];
+        _mm_store_si128((block *)indexing, bits);
+        slices(table, 0, num_slice, first, n, indexing, &partial[omp_get_thread_num() * stride]); });
+
+    for (size_t j = 0; j < num_slice; j++)
+    {
+        answer[j] = _mm256_setzero_si256();
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            answer[j] = _mm256_xor_si256(answer[j], partial[t * stride + j]);
+        }
+    }
+}
+
+hashdatastore::hash_type hashdatastore::answer_pir_fused(const std::vector<uint8_t> &key, size_t logn, size_t num_threads) const
+{
+    hash_type answer;
+    answer_pir_fused({{data_.data()}, data_.size(), 1}, key, logn, num_threads, &answer);
+    return answer;
+}
+
+std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> hashdatastore::answer_pir_fused_slices(const std::vector<uint8_t> &key, size_t logn, size_t num_threads) const
+{
+    std::vector<hash_type, HashTypeAllocator> answer(num_slice());
+    answer_pir_fused(slice_pointers(), key, logn, num_threads, answer.data());
+    return answer;
+}
+
+// "0-3,8,10-11" style lists of /sys/devices/system
+static std::vector<int> read_list(const std::string &path)
+{
+    std::vector<int> list;
+    std::ifstream in(path);
+    std::string range;
+    while (std::getline(in, range, ','))
+    {
+        int first, last;
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1)
+            continue;
+        for (int i = first; i <= (n == 2 ? last : first); i++)
+        {
+            list.push_back(i);
+        }
+    }
+    return list;
+}
+
+std::vector<int> hashdatastore::numaNodes()
+{
+    std::vector<int> nodes = read_list("/sys/devices/system/node/online");
+    if (nodes.empty())
+        nodes.push_back(0);
+    return nodes;
+}
+
+// mbind(2) without libnuma
+static const int MPOL_BIND_ = 2;
+static const int MPOL_INTERLEAVE_ = 3;
+
+static bool bind_pages(void *addr, size_t len, int mode, const std::vector<int> &nodes)
+{
+    unsigned long mask[16] = {};
+    for (int node : nodes)
+    {
+        if (node < 0 || node >= (int)(8 * sizeof(mask)))
+            return false;
+        mask[node / 64] |= 1UL << (node % 64);
+    }
+    return syscall(SYS_mbind, addr, len, mode, mask, 8 * sizeof(mask) + 1, 0) == 0;
+}
+
+static bool multi_node()
+{
+    static const bool multi = hashdatastore::numaNodes().size() > 1;
+    return multi;
+}
+
+// node the calling thread is pinned to by pin_to_node, -1 if none
+static thread_local int tPinnedNode = -1;
+
+// pins the calling thread to the CPUs of node, a no-op if it already is
+static void pin_to_node(int node)
+{
+    if (tPinnedNode == node)
+        return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : read_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+    {
+        CPU_SET(cpu, &cpus);
+    }
+    if (CPU_COUNT(&cpus) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0)
+        tPinnedNode = node;
+}
+
+// undoes pin_to_node on the calling thread
+static void unpin(const cpu_set_t &cpus)
+{
+    if (tPinnedNode < 0)
+        return;
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    tPinnedNode = -1;
+}
+
+void hashdatastore::answer_pir_batch(const slice_table &table, const std::vector<const std::vector<uint8_t> *> &indexings, size_t num_threads, Kernel kernel, hash_type *out) const
+{
+    const answer_slices_fn slices = answer_kernels[kernel].slices;
+    assert(table.num_rows % 8 == 0);
+    const size_t num_rows = table.num_rows;
+    const size_t num_slice = table.slices.size();
+    const size_t num_query = indexings.size();
+    // slice-major tables are walked one slice at a time, record-major ones all slices at once
+    const size_t group = table.row_stride == 1 ? 1 : num_slice;
+    const size_t num_groups = table.row_stride == 1 ? num_slice : 1;
+    // a tile of about 16 KB of data stays in L1 while every query is applied to it, a thread
+    // takes 8 tiles (about 128 KB, L2 sized) of one slice group at a time
+    const size_t tile = std::max<size_t>(8, (512 / table.row_stride) & ~static_cast<size_t>(7));
+    const size_t chunk = 8 * tile;
+    const size_t num_chunks = (num_rows + chunk - 1) / chunk;
+    // per-thread partial answers, padded so that no two threads share a cache line
+    const size_t stride = (num_slice * num_query + 3) & ~static_cast<size_t>(1);
+    std::vector<hash_type, HashTypeAllocator> partial(num_threads * stride, _mm256_setzero_si256());
+    // rows [begin, end) of slice group g into the calling thread's partial answers
+    auto scan = [&](size_t begin, size_t end, size_t g)
+    {
+        hash_type *acc = &partial[omp_get_thread_num() * stride + g * group];
+        for (size_t i = begin; i < end; i += tile)
+        {
+            size_t n = std::min(tile, end - i);
+            for (size_t q = 0; q < num_query; q++)
+            {
+                slices(table, g * group, group, i, n, indexings[q]->data() + i / 8, acc + q * num_slice);
+            }
+        }
+    };
+    if (table.partitions.empty())
+    {
+        // clang-format off
+        #pragma omp parallel for num_threads(num_threads) schedule(static) collapse(2)
+        // clang-format on
+        for (size_t c = 0; c < num_chunks; c++)
+        {
+            for (size_t g = 0; g < num_groups; g++)
+            {
+                scan(c * chunk, std::min(num_rows, (c + 1) * chunk), g);
+            }
+        }
+    }
+    else
+    {
+        // the threads are spread evenly over the partitions and scan theirs pinned to its node;
+        // with fewer threads than partitions, thread t takes every partition p with p * T / P == t.
+        // every thread restores its own affinity before leaving, pool threads outlive the call
+        const size_t num_parts = table.nodes.size();
+        // clang-format off
+        #pragma omp parallel num_threads(num_threads)
+        // clang-format on
+        {
+            cpu_set_t own;
+            pthread_getaffinity_np(pthread_self(), sizeof(own), &own);
+            const size_t T = omp_get_num_threads(), t = omp_get_thread_num();
+            for (size_t p = 0; p < num_parts; p++)
+            {
+                size_t first = (p * T + num_parts - 1) / num_parts, last = ((p + 1) * T + num_parts - 1) / num_parts;
+                if (first == last)
+                {
+                    first = p * T / num_parts;
+                    last = first + 1;
+                }
+                if (t < first || t >= last)
+                    continue;
+                if (multi_node())
+                    pin_to_node(table.nodes[p]);
+                const size_t begin = table.partitions[p], end = table.partitions[p + 1];
+                const size_t items = (end - begin + chunk - 1) / chunk * num_groups;
+                for (size_t k = t - first; k < items; k += last - first)
+                {
+                    size_t c = k / num_groups;
+                    scan(begin + c * chunk, std::min(end, begin + (c + 1) * chunk), k % num_groups);
+                }
+            }
+            unpin(own);
+        }
+    }
+
+    for (size_t k = 0; k < num_query * num_slice; k++)
+    {
+        out[k] = _mm256_setzero_si256();
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            out[k] = _mm256_xor_si256(out[k], partial[t * stride + k]);
+        }
+    }
+}
+
+void hashdatastore::answer_pir_batch(const std::vector<const std::vector<uint8_t> *> &indexings, std::vector<hash_type, HashTypeAllocator> &out, size_t num_threads) const
+{
+    out.resize(indexings.size());
+    slice_table table = {{data_.data()}, data_.size(), 1};
+    answer_pir_batch(table, indexings, num_threads, tuned_kernel(table, num_threads), out.data());
+}
+
+void hashdatastore::answer_pir_batch(const std::vector<const std::vector<uint8_t> *> &indexings, size_t slice_index, std::vector<hash_type, HashTypeAllocator> &out, size_t num_threads) const
+{
+    slice_table table = slice_pointers();
+    out.resize(indexings.size());
+    table.slices = {table.slices[slice_index]};
+    answer_pir_batch(table, indexings, num_threads, tuned_kernel(table, num_threads), out.data());
+}
+
+hashdatastore::slice_table hashdatastore::slice_pointers() const
+{
+    if (mapping_)
+        return mapped_table_;
+    slice_table table;
+    if (!records_.empty())
+    {
+        for (size_t j = 0; j < record_slices_; j++)
+        {
+            table.slices.push_back(records_.data() + j);
+        }
+        table.num_rows = records_.size() / record_stride_;
+        table.row_stride = record_stride_;
+        return table;
+    }
+    for (size_t j = 0; j < data_s.size(); j++)
+    {
+        assert(data_s[j].size() == data_s[0].size());
+        table.slices.push_back(data_s[j].data());
+    }
+    table.num_rows = data_s.empty() ? 0 : data_s[0].size();
+    table.row_stride = 1;
+    return table;
+}
+
+void hashdatastore::answer_pir_batch_slices(const std::vector<const std::vector<uint8_t> *> &indexings, size_t num_threads, std::vector<hash_type, HashTypeAllocator> &out) const
+{
+    out.resize(indexings.size() * num_slice());
+    slice_table table = slice_pointers();
+    answer_pir_batch(table, indexings, num_threads, tuned_kernel(table, num_threads), out.data());
+}
+
+hashdatastore::hash_type hashdatastore::answer_pir_parallel(const std::vector<uint8_t> &indexing, size_t num_threads) const
+{
+    hash_type answer;
+    slice_table table = {{data_.data()}, data_.size(), 1};
+    answer_pir_batch(table, {&indexing}, num_threads, tuned_kernel(table, num_threads), &answer);
+    return answer;
+}
+
+std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> hashdatastore::answer_pir_parallel_slices(const std::vector<uint8_t> &indexing, size_t num_threads) const
+{
+    std::vector<hash_type, HashTypeAllocator> answer;
+    answer_pir_batch_slices({&indexing}, num_threads, answer);
+    return answer;
+}
+
+size_t hashdatastore::num_slice() const
+{
+    if (mapping_)
+        return mapped_table_.slices.size();
+    return records_.empty() ? data_s.size() : record_slices_;
+}
+
+bool hashdatastore::record_major() const
+{
+    if (mapping_)
+        return mapped_table_.row_stride != 1;
+    return !records_.empty();
+}
+
+void hashdatastore::to_record_major()
+{
+    if (data_s.empty() || !records_.empty())
+        return;
+    const size_t num_rows = data_s[0].size();
+    record_slices_ = data_s.size();
+    // records of more than one hash_type start on a cache line
+    record_stride_ = record_slices_ == 1 ? 1 : (record_slices_ + 1) & ~static_cast<size_t>(1);
+    records_.assign(num_rows * record_stride_, _mm256_setzero_si256());
+    for (size_t j = 0; j < record_slices_; j++)
+    {
+        assert(data_s[j].size() == num_rows);
+        for (size_t i = 0; i < num_rows; i++)
+        {
+            records_[i * record_stride_ + j] = data_s[j][i];
+        }
+        std::vector<hash_type, HashTypeAllocator>().swap(data_s[j]);
+    }
+    data_s.clear();
+}
+
+static const char SNAPSHOT_MAGIC[8] = {'D', 'P', 'F', 'P', 'I', 'R', 'S', 'N'};
+
+bool hashdatastore::save_snapshot(const std::string &path, uint64_t logn, uint64_t mode) const
+{
+    slice_table table = slice_pointers();
+    snapshot_header header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.row_stride = table.row_stride;
+    header.logn = logn;
+    header.mode = mode;
+    header.num_rows = table.num_rows;
+    header.num_slice = table.slices.size();
+    header.num_hashes = hashs_.size();
+    const size_t page = 4096;
+    header.data_offset = (sizeof(header) + hashs_.size() * sizeof(uint64_t) + page - 1) / page * page;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+    file.write((const char *)&header, sizeof(header));
+    for (size_t i = 0; i < hashs_.size(); i++)
+    {
+        uint64_t hash = hashs_[i];
+        file.write((const char *)&hash, sizeof(hash));
+    }
+    std::vector<char> padding(header.data_offset - sizeof(header) - hashs_.size() * sizeof(uint64_t), 0);
+    file.write(padding.data(), padding.size());
+    if (table.row_stride == 1)
+    {
+        for (size_t j = 0; j < table.slices.size(); j++)
+        {
+            file.write((const char *)table.slices[j], table.num_rows * sizeof(hash_type));
+        }
+    }
+    else if (!table.slices.empty())
+    {
+        file.write((const char *)table.slices[0], table.num_rows * table.row_stride * sizeof(hash_type));
+    }
+    return file.good();
+}
+
+bool hashdatastore::load_snapshot(const std::string &path, snapshot_header &header)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) || read(fd, &header, sizeof(header)) != sizeof(header))
+    {
+        close(fd);
+        return false;
+    }
+    const size_t file_size = st.st_size;
+    // hashes are either absent or one per row; a record holds all its slices, padded to an even
+    // count as to_record_major writes it (the AVX-512 kernels load slices in pairs). every size is
+    // overflow-checked so that a corrupt header cannot pass the bounds check by wrapping around
+    uint64_t table_size, table_bytes, hash_bytes, table_end;
+    bool overflow = header.row_stride == 1 ? __builtin_mul_overflow(header.num_slice, header.num_rows, &table_size)
+                                           : __builtin_mul_overflow(header.num_rows, header.row_stride, &table_size);
+    overflow = overflow || __builtin_mul_overflow(table_size, sizeof(hash_type), &table_bytes) ||
+               __builtin_add_overflow(header.data_offset, table_bytes, &table_end) ||
+               __builtin_mul_overflow(header.num_hashes, sizeof(uint64_t), &hash_bytes);
+    if (overflow || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.row_stride == 0 || (header.row_stride != 1 && header.row_stride < header.num_slice) ||
+        (header.row_stride != 1 && header.num_slice > 1 && header.row_stride % 2 != 0) ||
+        (header.num_hashes != 0 && header.num_hashes != header.num_rows) || header.num_rows % 8 != 0 ||
+        header.data_offset % 4096 != 0 || header.data_offset < sizeof(header) || header.data_offset - sizeof(header) < hash_bytes ||
+        file_size < table_end)
+    {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+    // start reading the table in ahead of the first query
+    madvise(base, file_size, MADV_WILLNEED);
+    mapping_.reset(base, [file_size](void *p)
+                   { munmap(p, file_size); });
+
+    const uint64_t *hashes = (const uint64_t *)((const char *)base + sizeof(header));
+    hashs_.assign(hashes, hashes + header.num_hashes);
+    const hash_type *data = (const hash_type *)((const char *)base + header.data_offset);
+    mapped_table_.slices.clear();
+    for (size_t j = 0; j < header.num_slice; j++)
+    {
+        mapped_table_.slices.push_back(header.row_stride == 1 ? data + j * header.num_rows : data + j);
+    }
+    mapped_table_.num_rows = header.num_rows;
+    mapped_table_.row_stride = header.row_stride;
+    mapped_table_.partitions.clear();
+    mapped_table_.nodes.clear();
+    std::vector<std::vector<hash_type, HashTypeAllocator>>().swap(data_s);
+    std::vector<hash_type, RecordAllocator>().swap(records_);
+    return true;
+}
+
+bool hashdatastore::place(PageSize pages, NumaPolicy numa)
+{
+    return place(pages, numa, numaNodes());
+}
+
+bool hashdatastore::place(PageSize pages, NumaPolicy numa, const std::vector<int> &nodes)
+{
+    slice_table table = slice_pointers();
+    if (table.slices.empty() || table.num_rows == 0 || nodes.empty())
+        return false;
+    const size_t page = pages == PAGES_HUGETLB_1G ? 1ULL << 30 : pages == PAGES_DEFAULT ? 4096 : 2ULL << 20;
+    // slice-major tables are num_slice arrays of num_rows hash_types, record-major ones a single
+    // array of records; every array starts on a page
+    const size_t num_arrays = table.row_stride == 1 ? table.slices.size() : 1;
+    const size_t row_bytes = table.row_stride * sizeof(hash_type);
+    const size_t array_bytes = (table.num_rows * row_bytes + page - 1) / page * page;
+    const size_t size = num_arrays * array_bytes;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (pages == PAGES_HUGETLB_2M)
+        flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+    else if (pages == PAGES_HUGETLB_1G)
+        flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+    // transparent huge pages need a 2 MB aligned range, map one page more and trim
+    const size_t slack = pages == PAGES_TRANSPARENT ? page : 0;
+    char *mapped = (char *)mmap(nullptr, size + slack, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (mapped == MAP_FAILED)
+        return false;
+    char *base = mapped;
+    if (slack)
+    {
+        base = (char *)(((uintptr_t)mapped + page - 1) & ~(uintptr_t)(page - 1));
+        if (base != mapped)
+            munmap(mapped, base - mapped);
+        if (base + size != mapped + size + slack)
+            munmap(base + size, mapped + size + slack - (base + size));
+        madvise(base, size, MADV_HUGEPAGE);
+    }
+
+    // partition boundaries fall on pages and on selection bytes
+    std::vector<size_t> partitions;
+    if (numa == NUMA_PARTITION)
+    {
+        size_t granule = 8;
+        while (granule * row_bytes % page != 0)
+        {
+            granule *= 2;
+        }
+        for (size_t p = 0; p < nodes.size(); p++)
+        {
+            partitions.push_back(std::min(table.num_rows, table.num_rows * p / nodes.size() / granule * granule));
+        }
+        partitions.push_back(table.num_rows);
+    }
+    // a single node has nothing to spread, the NUMA syscalls may not even exist
+    bool bound = true;
+    if (multi_node())
+    {
+        if (numa == NUMA_INTERLEAVE)
+            bound = bind_pages(base, size, MPOL_INTERLEAVE_, nodes);
+        for (size_t a = 0; a < num_arrays && !partitions.empty() && bound; a++)
+        {
+            for (size_t p = 0; p < nodes.size() && bound; p++)
+            {
+                size_t begin = partitions[p] * row_bytes;
+                size_t end = p + 1 == nodes.size() ? array_bytes : partitions[p + 1] * row_bytes;
+                if (end > begin)
+                    bound = bind_pages(base + a * array_bytes + begin, end - begin, MPOL_BIND_, {nodes[p]});
+            }
+        }
+    }
+    if (!bound)
+    {
+        munmap(base, size);
+        return false;
+    }
+
+    // the copy faults the pages in under their policy
+    slice_table placed;
+    for (size_t a = 0; a < num_arrays; a++)
+    {
+        hash_type *array = (hash_type *)(base + a * array_bytes);
+        memcpy(array, table.slices[a], table.num_rows * row_bytes);
+        if (table.row_stride == 1)
+            placed.slices.push_back(array);
+    }
+    for (size_t j = 0; j < table.slices.size() && table.row_stride != 1; j++)
+    {
+        placed.slices.push_back((const hash_type *)base + j);
+    }
+    placed.num_rows = table.num_rows;
+    placed.row_stride = table.row_stride;
+    if (!partitions.empty())
+    {
+        placed.partitions = partitions;
+        placed.nodes = nodes;
+    }
+    mapping_.reset(base, [size](void *p)
+                   { munmap(p, size); });
+    mapped_table_ = placed;
+    std::vector<std::vector<hash_type, HashTypeAllocator>>().swap(data_s);
+    std::vector<hash_type, RecordAllocator>().swap(records_);
+    return true;
+}
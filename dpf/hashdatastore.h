@@ -8,12 +8,14 @@
 #include <string>
 #include <cassert>
 #include <iostream>
+#include <memory>
 
 class hashdatastore
 {
 public:
     typedef __m256i hash_type;
     using HashTypeAllocator = AlignmentAllocator<hash_type, sizeof(hash_type)>;
+    using RecordAllocator = AlignmentAllocator<hash_type, 64>;
     enum KeywordType
     {
         STRING,
@@ -75,6 +77,88 @@ public:
 
     size_t size() const { return data_.size(); }
 
+    // slices per record, in any layout
+    size_t num_slice() const;
+
+    // moves data_s into a record-major table where the slices of a record are contiguous and every
+    // record starts on a cache line; multi-slice answers then take a single pass over the rows.
+    // data_s is empty afterwards, only the *_slices answers (and the slice_index batch) read the table
+    void to_record_major();
+    bool record_major() const;
+
+    // slice j of row i is slices[j][i * row_stride]. a NUMA-partitioned table keeps rows
+    // [partitions[p], partitions[p + 1]) on node nodes[p]; both are empty otherwise
+    struct slice_table
+    {
+        std::vector<const hash_type *> slices;
+        size_t num_rows;
+        size_t row_stride;
+        std::vector<size_t> partitions;
+        std::vector<int> nodes;
+    };
+
+    // reorders hashs_ and every slice of data_s by ascending hash, as required by DPF::EvalPoints
+    void sort_by_hash();
+
+    // size classes for records of widths[i] slices: class c is a table of class_widths[c] slices
+    // (the returned vector) and record i goes to class record_class[i]. neighbouring widths share
+    // a class unless a table of their own saves more than overhead_bytes of scanning per query,
+    // so a few long values no longer pad every record to the longest one
+    static std::vector<size_t> size_classes(const std::vector<size_t> &widths, std::vector<size_t> &record_class, size_t overhead_bytes = 1 << 20);
+
+    // cuckoo-hashed dense table of 2^logn buckets: every keyword sits in one of its CUCKOO_NUM_HASH
+    // candidate buckets, data_s[0..num_slice) hold the values and data_s[num_slice] the fingerprints
+    static const size_t CUCKOO_NUM_HASH = 3;
+    static size_t cuckoo_bucket(const std::string &keyword, size_t hash_id, size_t logn);
+    static uint64_t cuckoo_fingerprint(const std::string &keyword);
+    bool build_cuckoo(const std::vector<std::string> &keywords, const std::vector<std::vector<std::string>> &data_str_s, size_t num_slice, size_t logn);
+
+    // on-disk snapshot: this header, num_hashes (0 or num_rows) 64-bit keyword hashes and then the table starting
+    // at data_offset (page aligned), either num_slice arrays of num_rows hash_types (slice-major)
+    // or num_rows records of row_stride hash_types (record-major)
+    struct snapshot_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t row_stride;
+        uint64_t logn; // not interpreted, for the caller
+        uint64_t mode; // not interpreted, for the caller
+        uint64_t num_rows;
+        uint64_t num_slice;
+        uint64_t num_hashes;
+        uint64_t data_offset;
+    };
+    static const uint32_t SNAPSHOT_VERSION = 1;
+    bool save_snapshot(const std::string &path, uint64_t logn, uint64_t mode) const;
+    // maps the snapshot read-only and answers straight from the mapping; hashs_ is copied, data_s
+    // stays empty. returns false if the file is missing or malformed
+    bool load_snapshot(const std::string &path, snapshot_header &header);
+
+    // memory placement of the table. PAGES_TRANSPARENT asks for transparent 2 MB pages (madvise),
+    // PAGES_HUGETLB_2M and PAGES_HUGETLB_1G take reserved hugetlbfs pages (MAP_HUGETLB).
+    // NUMA_INTERLEAVE spreads the pages round-robin over the nodes, NUMA_PARTITION binds one
+    // contiguous range of rows to each node and the batch answers scan every range with threads
+    // pinned to its node's CPUs
+    enum PageSize
+    {
+        PAGES_DEFAULT,
+        PAGES_TRANSPARENT,
+        PAGES_HUGETLB_2M,
+        PAGES_HUGETLB_1G
+    };
+    enum NumaPolicy
+    {
+        NUMA_DEFAULT,
+        NUMA_INTERLEAVE,
+        NUMA_PARTITION
+    };
+    // moves the table, in its layout, into an anonymous mapping placed this way over the given
+    // nodes (all online nodes by default) and answers from it like load_snapshot; data_s is empty
+    // afterwards. returns false and leaves the table as it was if the pages cannot be mapped or bound
+    bool place(PageSize pages, NumaPolicy numa);
+    bool place(PageSize pages, NumaPolicy numa, const std::vector<int> &nodes);
+    static std::vector<int> numaNodes();
+
     hash_type answer_pir1(const std::vector<uint8_t> &indexing) const;
     hash_type answer_pir2(const std::vector<uint8_t> &indexing) const;
     hash_type answer_pir2(const std::vector<uint8_t> &indexing, size_t num_value_slice) const;
@@ -83,7 +167,62 @@ public:
     hash_type answer_pir5(const std::vector<uint8_t> &indexing) const;
     hash_type answer_pir_idea_speed_comparison(const std::vector<uint8_t> &indexing) const;
 
+    // fused DPF full-domain evaluation and inner product: every 128-bit leaf block is applied to its
+    // 128 rows right away, so the 2^(logn-3) byte selection vector is never materialized
+    hash_type answer_pir_fused(const std::vector<uint8_t> &key, size_t logn, size_t num_threads) const;
+    std::vector<hash_type, HashTypeAllocator> answer_pir_fused_slices(const std::vector<uint8_t> &key, size_t logn, size_t num_threads) const;
+
+    // answers several queries in one pass over the data: every cache-resident tile of rows is applied
+    // to all selection vectors before moving on, out[q] equals answer_pir2(*indexings[q])
+    void answer_pir_batch(const std::vector<const std::vector<uint8_t> *> &indexings, std::vector<hash_type, HashTypeAllocator> &out, size_t num_threads = 1) const;
+    void answer_pir_batch(const std::vector<const std::vector<uint8_t> *> &indexings, size_t slice_index, std::vector<hash_type, HashTypeAllocator> &out, size_t num_threads = 1) const;
+    // all slices of data_s at once, out[q * data_s.size() + j] answers query q on slice j
+    void answer_pir_batch_slices(const std::vector<const std::vector<uint8_t> *> &indexings, size_t num_threads, std::vector<hash_type, HashTypeAllocator> &out) const;
+
+    // kernels behind the parallel, fused and batch answers: AVX-512 loads the selection bits into
+    // mask registers and XORs two rows (or two slices of a record) per 512-bit lane under them,
+    // AVX2 turns every bit into a 256-bit mask, AVX2_TABLE looks the masks up per selection byte
+    // (answer_pir5) and AVX2_MASKLOAD skips unselected rows with masked loads (answer_pir3); the
+    // two answer record-major tables like AVX2. the *_PREFETCH kernels prefetch the rows
+    // prefetchDistance() bytes ahead with the non-temporal hint, AVX2_PREFETCH also reads them with
+    // streaming loads. the widest plain kernel the CPU supports is the default; setKernel replaces
+    // it, drops the autotuned choices and returns false if the CPU lacks the kernel
+    enum Kernel
+    {
+        KERNEL_AVX2,
+        KERNEL_AVX512,
+        KERNEL_AVX2_TABLE,
+        KERNEL_AVX2_MASKLOAD,
+        KERNEL_AVX2_PREFETCH,
+        KERNEL_AVX512_PREFETCH,
+        NUM_KERNELS
+    };
+    static Kernel kernel();
+    // the kernel answers on a table of this layout and width run with on num_threads threads
+    static Kernel kernel(bool record_major, size_t num_slice, size_t num_threads);
+    static bool supports(Kernel kernel);
+    static bool setKernel(Kernel kernel);
+    static const char *kernelName(Kernel kernel);
+    // process-wide, 0 turns the prefetch off
+    static size_t prefetchDistance();
+    static void setPrefetchDistance(size_t bytes);
+
+    // times every kernel the CPU supports on the first sample_bytes of this table, answering one
+    // query with num_threads threads, and pins the fastest one for the table's layout, slices per
+    // record and num_threads. kernels whose answer differs from AVX2 are left out. the choice and
+    // the timings are written to log if given; meant to run once the table is loaded
+    Kernel autotune(size_t num_threads, std::ostream *log = nullptr, size_t sample_bytes = 32 << 20) const;
+
+    // answer_pir2 on num_threads threads: rows are split into L2-sized chunks, each (chunk, slice)
+    // pair goes to one thread's partial answer and the partials are XORed at the end
+    hash_type answer_pir_parallel(const std::vector<uint8_t> &indexing, size_t num_threads) const;
+    std::vector<hash_type, HashTypeAllocator> answer_pir_parallel_slices(const std::vector<uint8_t> &indexing, size_t num_threads) const;
+
 private:
+    slice_table slice_pointers() const;
+    void answer_pir_fused(const slice_table &table, const std::vector<uint8_t> &key, size_t logn, size_t num_threads, hash_type *answer) const;
+    void answer_pir_batch(const slice_table &table, const std::vector<const std::vector<uint8_t> *> &indexings, size_t num_threads, Kernel kernel, hash_type *out) const;
+
     hash_type string2m256i(std::string data_str)
     {
         assert(data_str.size() <= 32);
@@ -146,5 +285,11 @@ public:
 
 private:
     std::vector<hash_type, HashTypeAllocator> data_;
+    std::vector<hash_type, RecordAllocator> records_;
+    size_t record_slices_ = 0;
+    size_t record_stride_ = 1;
+    // table of a loaded snapshot, valid while mapping_ is alive
+    std::shared_ptr<void> mapping_;
+    slice_table mapped_table_;
     std::hash<std::string> hashFunction_;
 };
@@ -3,6 +3,7 @@
 
 #include <chrono>
 #include <iostream>
+#include "omp.h"
 
 int main(int argc, char **argv)
 {
@@ -13,9 +14,9 @@ int main(int argc, char **argv)
         return -1;
     }
     size_t NN = std::strtoull(argv[1], nullptr, 10);
-    std::chrono::duration<double> buildT, evalT, answerT;
+    std::chrono::duration<double> buildT, evalT, answerT, fusedT;
     size_t keysizeT = 0;
-    buildT = evalT = answerT = std::chrono::duration<double>::zero();
+    buildT = evalT = answerT = fusedT = std::chrono::duration<double>::zero();
     for (size_t N = NN; N > 0; N--)
     {
         if ((1ULL << N) < 8) // assert(data_.size() % 8 == 0);
@@ -57,13 +58,25 @@ int main(int argc, char **argv)
         std::cout << "answerB:" << _mm256_extract_epi64(answerB, 0) << std::endl;
         std::cout << "answer:" << _mm256_extract_epi64(answer, 0) << std::endl;
 
+        // same query through the fused path, without materializing the selection vectors
+        auto time5 = std::chrono::high_resolution_clock::now();
+        if (N >= 10)
+        {
+            hashdatastore::hash_type fusedA = store.answer_pir_fused(a, N, omp_get_max_threads());
+            hashdatastore::hash_type fusedB = store.answer_pir_fused(b, N, omp_get_max_threads());
+            std::cout << "fused answer:" << _mm256_extract_epi64(_mm256_xor_si256(fusedA, fusedB), 0) << std::endl;
+        }
+        auto time6 = std::chrono::high_resolution_clock::now();
+
         buildT += time2 - time1;
         evalT += time3 - time2;
         answerT += time4 - time3;
+        fusedT += time6 - time5;
     }
     std::cout << "DPF.Gen: " << buildT.count() << "sec" << std::endl;
     std::cout << "DPF.Eval: " << evalT.count() << "sec" << std::endl;
     std::cout << "Inner Prod: " << answerT.count() << "sec" << std::endl;
+    std::cout << "DPF.Eval + Inner Prod fused: " << fusedT.count() << "sec" << std::endl;
     std::cout << keysizeT << "; " << NN * 32 << " bytes total transfer" << std::endl;
 
     return 0;
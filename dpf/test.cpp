@@ -1,10 +1,52 @@
 #include "dpf.h"
+#include "AES.h"
 #include "hashdatastore.h"
 
 #include <chrono>
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
 
 
+int testAESImpl() {
+    // every supported implementation must match the single block AES-NI rounds bit for bit
+    std::mt19937_64 rng(42);
+    std::vector<block> in(300), ecb(300), mmo(300), ctr(300), mmoL(300), mmoR(300);
+    for (auto& b : in) {
+        b = _mm_set_epi64x(rng(), rng());
+    }
+    AES::Impl prev = AES::impl();
+    int res = 0;
+    for (AES::Impl impl : {AES::AESNI, AES::VAES256, AES::VAES512}) {
+        if (!AES::setImpl(impl)) {
+            std::cout << "AES " << AES::implName(impl) << " not supported, skipped\n";
+            continue;
+        }
+        for (size_t n : {0, 1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 23, 31, 300}) {
+            mAesFixedKey.encryptECBBlocks(in.data(), n, ecb.data());
+            mAesFixedKey2.encryptECB_MMO_Blocks(in.data(), n, mmo.data());
+            mAesFixedKey.encryptCTR(1000, n, ctr.data());
+            mAesFixedKey.encryptECB_MMO_Blocks2(mAesFixedKey2, in.data(), n, mmoL.data(), mmoR.data());
+            for (size_t i = 0; i < n; i++) {
+                block c = mAesFixedKey.encryptECB(_mm_set1_epi64x(1000 + i));
+                if (!eq(ecb[i], mAesFixedKey.encryptECB(in[i])) ||
+                    !eq(mmo[i], mAesFixedKey2.encryptECB_MMO(in[i])) || !eq(ctr[i], c) ||
+                    !eq(mmoL[i], mAesFixedKey.encryptECB_MMO(in[i])) || !eq(mmoR[i], mmo[i])) {
+                    std::cout << "AES " << AES::implName(impl) << " wrong for " << n << " blocks\n";
+                    res = -1;
+                    break;
+                }
+            }
+        }
+    }
+    AES::setImpl(prev);
+    return res;
+}
+
 int testEvalFull8()  {
 
     size_t N = 11;
@@ -53,9 +95,801 @@ int testCorr() {
 
 }
 
+int testEvalPoints() {
+    size_t N = 48;
+    size_t alpha = 0x123456789ULL;
+    auto keys = DPF::Gen(alpha, N);
+    auto a = keys.first;
+    auto b = keys.second;
+
+    // random points plus duplicates, neighbours within one leaf and the point itself
+    std::mt19937_64 rng(42);
+    std::vector<size_t> points;
+    for (size_t i = 0; i < 1003; i++) {
+        points.push_back(rng() & ((1ULL << N) - 2));
+    }
+    points.push_back(alpha);
+    points.push_back(alpha);
+    points.push_back(alpha + 1);
+    points.push_back(alpha - 1);
+    points.push_back(points[0]);
+    std::sort(points.begin(), points.end());
+
+    std::vector<uint8_t> resA, resB;
+    DPF::EvalPoints(a, points, N, resA);
+    DPF::EvalPoints(b, points, N, resB);
+    for (size_t i = 0; i < points.size(); i++) {
+        bool bitA = (resA[i / 8] >> (i % 8)) & 1;
+        bool bitB = (resB[i / 8] >> (i % 8)) & 1;
+        if (bitA != DPF::Eval(a, points[i], N) || (bitA ^ bitB) != (points[i] == alpha)) {
+            std::cout << "EvalPoints and Eval differ at point " << points[i] << std::endl;
+            return -1;
+        }
+    }
+    // EvalKeywords walks 8 points in lockstep, with a partial group at the end
+    std::vector<uint8_t> resK;
+    DPF::EvalKeywords(a, std::vector<size_t>(points.begin(), points.begin() + 1005), N, resK);
+    for (size_t i = 0; i < 1005; i++) {
+        if (((resK[i / 8] >> (i % 8)) & 1) != ((resA[i / 8] >> (i % 8)) & 1)) {
+            std::cout << "EvalKeywords and EvalPoints differ at point " << points[i] << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testParsedKey() {
+    size_t N = 20;
+    auto keys = DPF::Gen(0xABCDE, N);
+    DPF::Key a(keys.first);
+    if (a.sCW.size() != N - 7 || a.t0 != keys.first[16] || a.tL(3) != keys.first[17 + 3 * 18 + 16] ||
+        a.tR(N - 8) != keys.first[17 + (N - 8) * 18 + 17]) {
+        std::cout << "DPF::Key parsed wrong\n";
+        return -1;
+    }
+    std::vector<size_t> points = {0, 1, 0xABCDE, 0xABCDF, 77777, (1ULL << N) - 2, 5, 0xABCDE};
+    std::vector<uint8_t> resKey, resBytes;
+    DPF::EvalKeywords(a, points, N, resKey);
+    DPF::EvalKeywords(keys.first, points, N, resBytes);
+    if (DPF::EvalFull8(a, N) != DPF::EvalFull8(keys.first, N) ||
+        DPF::Eval(a, 0xABCDE, N) != DPF::Eval(keys.first, 0xABCDE, N) || resKey != resBytes) {
+        std::cout << "DPF::Key and byte key evaluate differently\n";
+        return -1;
+    }
+    return 0;
+}
+
+int testLeafWidth() {
+    for (size_t leaf_bits : {DPF::LEAF_BITS_256, DPF::LEAF_BITS_512}) {
+        for (size_t N : {size_t(9), size_t(14), size_t(20)}) {
+            size_t alpha = 0x5A5A5 % ((1ULL << N) - 1);
+            auto keys = DPF::Gen(alpha, N, leaf_bits);
+            DPF::Key a(keys.first, N), b(keys.second, N);
+            if (a.leaf_bits != leaf_bits || a.sCW.size() != N - leaf_bits || keys.first.size() == DPF::Gen(alpha, N).first.size()) {
+                std::cout << "wide leaf key parsed wrong for " << leaf_bits << " leaf bits\n";
+                return -1;
+            }
+            std::vector<uint8_t> fa = DPF::EvalFull(a, N), fb = DPF::EvalFull(b, N);
+            for (size_t i = 0; i < fa.size(); i++) {
+                uint8_t expected = i == alpha / 8 ? uint8_t(1 << (alpha % 8)) : 0;
+                if ((fa[i] ^ fb[i]) != expected) {
+                    std::cout << "wide leaf EvalFull wrong for logn " << N << "\n";
+                    return -1;
+                }
+            }
+            std::vector<uint8_t> chunked;
+            DPF::EvalFullChunked(keys.first, N, 1000, [&](size_t, const uint8_t *data, size_t len) {
+                chunked.insert(chunked.end(), data, data + len);
+            });
+            if (DPF::EvalFullIterative(keys.first, N) != fa || chunked != fa) {
+                std::cout << "wide leaf EvalFullIterative / EvalFullChunked differ for logn " << N << "\n";
+                return -1;
+            }
+            // the 128-bit-only walkers hand wide keys on, mixed batches included
+            std::vector<uint8_t> leaves(fa.size());
+            DPF::EvalFullLeaves(keys.first, N, 2, [&](size_t i, const block &b) { memcpy(&leaves[16 * i], &b, 16); });
+            std::vector<std::vector<uint8_t>> batch = {keys.first, keys.second};
+            if (N >= 10) {
+                batch.push_back(DPF::Gen(alpha, N).first);
+            }
+            std::vector<std::vector<uint8_t>> many = DPF::EvalFullMany(batch, N, 2);
+            if (DPF::EvalFull8(keys.first, N) != fa || DPF::EvalFullParallel(keys.first, N, 2) != fa || leaves != fa ||
+                many[0] != fa || many[1] != fb || (N >= 10 && many[2] != DPF::EvalFull8(batch[2], N)) ||
+                !DPF::CompactKey(keys.first, N).empty()) {
+                std::cout << "wide leaf key not handed on for logn " << N << "\n";
+                return -1;
+            }
+            std::vector<size_t> points = {0, 3, 200, alpha, alpha ^ 128, alpha ^ 256, alpha + 1, (1ULL << N) - 2, 77 % (1ULL << N)};
+            std::vector<uint8_t> res;
+            DPF::EvalKeywords(keys.first, points, N, res);
+            std::vector<size_t> sorted = points;
+            std::sort(sorted.begin(), sorted.end());
+            std::vector<uint8_t> res_sorted;
+            DPF::EvalPoints(a, sorted, N, res_sorted);
+            for (size_t i = 0; i < points.size(); i++) {
+                bool bit = (fa[points[i] / 8] >> (points[i] % 8)) & 1;
+                if (((res[i / 8] >> (i % 8)) & 1) != bit || DPF::Eval(keys.first, points[i], N) != bit ||
+                    ((res_sorted[i / 8] >> (i % 8)) & 1) != ((fa[sorted[i] / 8] >> (sorted[i] % 8)) & 1)) {
+                    std::cout << "wide leaf point evaluation wrong for logn " << N << "\n";
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int testGenBatch() {
+    // more keys than one chunk, and a tree short enough to have no correction word levels
+    for (size_t N : {5, 20}) {
+        std::mt19937_64 rng(7);
+        std::vector<size_t> alphas;
+        for (size_t i = 0; i < 150; i++) {
+            alphas.push_back(rng() % ((1ULL << N) - 1));
+        }
+        auto keys = DPF::GenBatch(alphas, N, 2);
+        for (size_t i = 0; i < alphas.size(); i += 37) {
+            std::vector<uint8_t> a = DPF::EvalFull(keys[i].first, N);
+            std::vector<uint8_t> b = DPF::EvalFull(keys[i].second, N);
+            for (size_t j = 0; j < a.size(); j++) {
+                uint8_t expected = j == alphas[i] / 8 ? 1 << (alphas[i] % 8) : 0;
+                if ((a[j] ^ b[j]) != expected) {
+                    std::cout << "GenBatch key " << i << " wrong for logn " << N << "\n";
+                    return -1;
+                }
+            }
+        }
+        if (DPF::GenBatch(alphas, N)[0] == keys[0]) {
+            std::cout << "GenBatch keys repeat\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testCompactKey() {
+    for (size_t N : {5, 8, 20, 48}) {
+        auto keys = DPF::Gen(N == 5 ? 7 : N == 8 ? 123 : 12345, N);
+        for (const auto& key : {keys.first, keys.second}) {
+            std::vector<uint8_t> compact = DPF::CompactKey(key, N), legacy, decoded;
+            if (key.size() != DPF::KeySize(N) || compact.size() != DPF::CompactKeySize(N)) {
+                std::cout << "key sizes wrong for logn " << N << "\n";
+                return -1;
+            }
+            if (compact.size() >= key.size() && N > 8) {
+                std::cout << "compact key not smaller for logn " << N << "\n";
+                return -1;
+            }
+            if (!DPF::DecodeKey(compact, N, decoded) || decoded != key ||
+                !DPF::DecodeKey(key, N, legacy) || legacy != key) {
+                std::cout << "compact key round trip failed for logn " << N << "\n";
+                return -1;
+            }
+            // wrong logn, version or size
+            compact[0] ^= 1;
+            if (DPF::DecodeKey(compact, N, decoded) || DPF::DecodeKey(key, N + 3, decoded) ||
+                DPF::DecodeKey(std::vector<uint8_t>(key.begin(), key.end() - 1), N, decoded)) {
+                std::cout << "malformed key accepted for logn " << N << "\n";
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int testCuckoo() {
+    size_t N = 14;
+    std::vector<std::string> keywords;
+    std::vector<std::vector<std::string>> values;
+    for (size_t i = 0; i < 10000; i++) {
+        keywords.push_back("key" + std::to_string(i));
+        values.push_back({"value" + std::to_string(i)});
+    }
+    hashdatastore store;
+    if (!store.build_cuckoo(keywords, values, 1, N)) {
+        std::cout << "cuckoo insertion failed\n";
+        return -1;
+    }
+
+    std::string query = "key4242";
+    uint64_t fingerprint = hashdatastore::cuckoo_fingerprint(query);
+    size_t found = 0;
+    for (size_t h = 0; h < hashdatastore::CUCKOO_NUM_HASH; h++) {
+        auto keys = DPF::Gen(hashdatastore::cuckoo_bucket(query, h, N), N);
+        std::vector<uint8_t> aaaa = DPF::EvalFull8(keys.first, N);
+        std::vector<uint8_t> bbbb = DPF::EvalFull8(keys.second, N);
+        hashdatastore::hash_type fp = _mm256_xor_si256(store.answer_pir2(aaaa, 1), store.answer_pir2(bbbb, 1));
+        if ((uint64_t)_mm256_extract_epi64(fp, 0) != fingerprint) {
+            continue;
+        }
+        hashdatastore::hash_type value = _mm256_xor_si256(store.answer_pir2(aaaa, 0), store.answer_pir2(bbbb, 0));
+        // "value424" little endian in the top lane
+        if ((uint64_t)_mm256_extract_epi64(value, 3) != 0x34323465756c6176ULL) {
+            std::cout << "cuckoo value wrong\n";
+            return -1;
+        }
+        found++;
+    }
+    if (found != 1) {
+        std::cout << "cuckoo keyword found " << found << " times\n";
+        return -1;
+    }
+    return 0;
+}
+
+int testEvalFullParallel() {
+    size_t N = 20;
+    auto keys = DPF::Gen(98765, N);
+    auto a = keys.first;
+    std::vector<uint8_t> aaaa = DPF::EvalFull8(a, N);
+    // default split, shallowest and deepest split
+    if (DPF::EvalFullParallel(a, N, 4) != aaaa ||
+        DPF::EvalFullParallel(a, N, 3, 3) != aaaa ||
+        DPF::EvalFullParallel(a, N, 2, N - 7) != aaaa) {
+        std::cout << "EvalFull8 and EvalFullParallel differ\n";
+        return -1;
+    }
+    return 0;
+}
+
+int testFixedDepth() {
+    // compile-time depths against the generic evaluators
+    auto keys20 = DPF::Gen(54321, 20);
+    DPF::Key k20(keys20.first);
+    std::vector<uint8_t> full = DPF::EvalFull(keys20.first, 20);
+    if (DPF::EvalFull8<20>(k20) != full || DPF::EvalFull8(k20, 20) != full ||
+        DPF::Eval<20>(k20, 54321) != DPF::Eval(keys20.first, 54321, 20) ||
+        DPF::Eval<20>(k20, 1234) != (((full[1234 / 8] >> (1234 % 8)) & 1) != 0)) {
+        std::cout << "fixed depth 20 differs\n";
+        return -1;
+    }
+    auto keys24 = DPF::Gen(777777, 24);
+    DPF::Key k24(keys24.first);
+    if (DPF::EvalFull8<24>(k24) != DPF::EvalFull(keys24.first, 24)) {
+        std::cout << "fixed depth 24 differs\n";
+        return -1;
+    }
+    size_t alpha = 0xABCDEF012ULL;
+    auto keys48 = DPF::Gen(alpha, 48);
+    DPF::Key a(keys48.first), b(keys48.second);
+    std::vector<size_t> points = {5, 0x123456789ULL, alpha, alpha + 1};
+    std::vector<uint8_t> res;
+    DPF::EvalPoints(a, points, 48, res);
+    for (size_t i = 0; i < points.size(); i++) {
+        if (DPF::Eval<48>(a, points[i]) != (((res[0] >> i) & 1) != 0) ||
+            (DPF::Eval<48>(a, points[i]) ^ DPF::Eval<48>(b, points[i])) != (points[i] == alpha)) {
+            std::cout << "fixed depth 48 differs\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testEvalFullMany() {
+    // one key, a partial lockstep group and several groups; 0, 1 and more levels below the split
+    for (size_t N : {10, 13, 16}) {
+        for (size_t num_keys : {1, 3, 9}) {
+            std::vector<std::vector<uint8_t>> keys;
+            for (size_t k = 0; k < num_keys; k++) {
+                auto pair = DPF::Gen((k * 7919) % ((1ULL << N) - 1), N);
+                keys.push_back(k % 2 ? pair.second : pair.first);
+            }
+            for (size_t num_threads : {1, 3}) {
+                std::vector<std::vector<uint8_t>> full = DPF::EvalFullMany(keys, N, num_threads);
+                for (size_t k = 0; k < num_keys; k++) {
+                    if (full[k] != DPF::EvalFull8(keys[k], N)) {
+                        std::cout << "EvalFullMany differs from EvalFull8 for key " << k << " of " << num_keys << ", logn " << N << "\n";
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int testEvalFullIterative() {
+    // single subtree, several subtrees, and below EvalFull8's minimum
+    for (size_t N : {10, 19, 21}) {
+        auto keys = DPF::Gen(123456 % (1ULL << N), N);
+        if (DPF::EvalFullIterative(keys.first, N) != DPF::EvalFull8(keys.first, N) ||
+            DPF::EvalFullIterative(keys.second, N) != DPF::EvalFull8(keys.second, N)) {
+            std::cout << "EvalFull8 and EvalFullIterative differ for logn " << N << "\n";
+            return -1;
+        }
+    }
+    for (size_t N : {7, 8, 9}) {
+        auto keys = DPF::Gen(77, N);
+        if (DPF::EvalFullIterative(keys.first, N) != DPF::EvalFull(keys.first, N)) {
+            std::cout << "EvalFull and EvalFullIterative differ for logn " << N << "\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testEvalFullChunked() {
+    // one leaf per chunk, a chunk size that is not a power of two, and one chunk for the domain
+    for (size_t N : {7, 12, 20}) {
+        auto keys = DPF::Gen(3333 % (1ULL << N), N);
+        std::vector<uint8_t> full = DPF::EvalFull(keys.first, N);
+        for (size_t chunk_bytes : {size_t(16), size_t(5000), size_t(1) << 30}) {
+            std::vector<uint8_t> out;
+            bool in_order = true;
+            DPF::EvalFullChunked(keys.first, N, chunk_bytes, [&](size_t offset, const uint8_t *data, size_t len) {
+                in_order &= offset == out.size() && len <= chunk_bytes && len <= full.size();
+                out.insert(out.end(), data, data + len);
+            });
+            if (!in_order || out != full) {
+                std::cout << "EvalFullChunked differs for logn " << N << ", chunk " << chunk_bytes << "\n";
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int testAnswerFused() {
+    size_t N = 20;
+    hashdatastore store;
+    store.reserve(1ULL << N);
+    for (size_t i = 0; i < (1ULL << N); i++) {
+        store.push_back(_mm256_set_epi64x(i, i, i, i));
+    }
+    auto keys = DPF::Gen(654321, N);
+    auto a = keys.first;
+    auto b = keys.second;
+    hashdatastore::hash_type answerA = store.answer_pir_fused(a, N, 4);
+    hashdatastore::hash_type answerB = store.answer_pir_fused(b, N, 3);
+    hashdatastore::hash_type expectedA = store.answer_pir2(DPF::EvalFull8(a, N));
+    hashdatastore::hash_type answer = _mm256_xor_si256(answerA, answerB);
+    if(_mm256_extract_epi64(answer, 0) != 654321 || _mm256_extract_epi64(_mm256_xor_si256(answerA, expectedA), 0) != 0) {
+        std::cout << "fused PIR answer wrong\n";
+        return -1;
+    }
+
+    std::vector<std::string> keywords;
+    std::vector<std::vector<std::string>> values;
+    for (size_t i = 0; i < 100; i++) {
+        keywords.push_back("key" + std::to_string(i));
+        values.push_back({"value" + std::to_string(i), "second slice"});
+    }
+    N = 10;
+    hashdatastore cuckoo;
+    cuckoo.build_cuckoo(keywords, values, 2, N);
+    std::vector<uint8_t> aaaa = DPF::EvalFull8(a = DPF::Gen(17, N).first, N);
+    auto fused = cuckoo.answer_pir_fused_slices(a, N, 2);
+    for (size_t j = 0; j < 3; j++) {
+        hashdatastore::hash_type diff = _mm256_xor_si256(fused[j], cuckoo.answer_pir2(aaaa, j));
+        if (!_mm256_testz_si256(diff, diff)) {
+            std::cout << "fused slice answer wrong\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testAnswerBatch() {
+    size_t N = 14;
+    hashdatastore store;
+    store.reserve(1ULL << N);
+    for (size_t i = 0; i < (1ULL << N); i++) {
+        store.push_back(_mm256_set_epi64x(i, 2 * i, 3 * i, i * i));
+    }
+    std::mt19937_64 rng(7);
+    std::vector<std::vector<uint8_t>> queries(5, std::vector<uint8_t>(1ULL << (N - 3)));
+    std::vector<const std::vector<uint8_t> *> query_ptrs;
+    for (auto &query : queries) {
+        for (auto &byte : query) {
+            byte = rng();
+        }
+        query_ptrs.push_back(&query);
+    }
+    std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> out;
+    store.answer_pir_batch(query_ptrs, out, 2);
+    for (size_t q = 0; q < queries.size(); q++) {
+        hashdatastore::hash_type diff = _mm256_xor_si256(out[q], store.answer_pir2(queries[q]));
+        if (out.size() != queries.size() || !_mm256_testz_si256(diff, diff)) {
+            std::cout << "batch PIR answer wrong\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testAnswerParallel() {
+    // not a multiple of the 4096-row chunk
+    size_t num_rows = 3 * 4096 + 8 * 37;
+    hashdatastore store;
+    store.resize_data(3);
+    for (size_t i = 0; i < num_rows; i++) {
+        store.push_back(_mm256_set_epi64x(i, 2 * i, 3 * i, i * i));
+        for (size_t j = 0; j < 3; j++) {
+            store.data_s[j].push_back(_mm256_set_epi64x(i, j, i * j, i ^ j));
+        }
+    }
+    std::mt19937_64 rng(11);
+    std::vector<uint8_t> query(num_rows / 8);
+    for (auto &byte : query) {
+        byte = rng();
+    }
+    for (size_t num_threads : {1, 3}) {
+        hashdatastore::hash_type diff = _mm256_xor_si256(store.answer_pir_parallel(query, num_threads), store.answer_pir2(query));
+        auto answer = store.answer_pir_parallel_slices(query, num_threads);
+        for (size_t j = 0; j < 3; j++) {
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(answer[j], store.answer_pir2(query, j)));
+        }
+        if (answer.size() != 3 || !_mm256_testz_si256(diff, diff)) {
+            std::cout << "parallel PIR answer wrong\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testRecordMajor() {
+    std::mt19937_64 rng(13);
+    for (size_t num_slice : {1, 3, 10}) {
+        size_t num_rows = 4096 + 8 * 5;
+        hashdatastore store;
+        store.resize_data(num_slice);
+        for (size_t i = 0; i < num_rows; i++) {
+            for (size_t j = 0; j < num_slice; j++) {
+                store.data_s[j].push_back(_mm256_set_epi64x(rng(), rng(), rng(), rng()));
+            }
+        }
+        std::vector<std::vector<uint8_t>> queries(3, std::vector<uint8_t>(num_rows / 8));
+        std::vector<const std::vector<uint8_t> *> query_ptrs;
+        for (auto &query : queries) {
+            for (auto &byte : query) {
+                byte = rng();
+            }
+            query_ptrs.push_back(&query);
+        }
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> expected, out;
+        store.answer_pir_batch_slices(query_ptrs, 1, expected);
+        store.to_record_major();
+        if (!store.record_major() || store.num_slice() != num_slice || !store.data_s.empty()) {
+            std::cout << "record-major conversion wrong\n";
+            return -1;
+        }
+        store.answer_pir_batch_slices(query_ptrs, 2, out);
+        hashdatastore::hash_type diff = _mm256_setzero_si256();
+        for (size_t k = 0; k < expected.size(); k++) {
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(out[k], expected[k]));
+        }
+        auto single = store.answer_pir_parallel_slices(queries[1], 3);
+        for (size_t j = 0; j < num_slice; j++) {
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(single[j], expected[num_slice + j]));
+        }
+        if (out.size() != expected.size() || !_mm256_testz_si256(diff, diff)) {
+            std::cout << "record-major PIR answer wrong\n";
+            return -1;
+        }
+    }
+
+    // fused path on a record-major cuckoo table
+    std::vector<std::string> keywords;
+    std::vector<std::vector<std::string>> values;
+    for (size_t i = 0; i < 100; i++) {
+        keywords.push_back("key" + std::to_string(i));
+        values.push_back({"value" + std::to_string(i), "second slice"});
+    }
+    size_t N = 10;
+    hashdatastore cuckoo;
+    cuckoo.build_cuckoo(keywords, values, 2, N);
+    auto a = DPF::Gen(23, N).first;
+    auto expected = cuckoo.answer_pir_fused_slices(a, N, 1);
+    cuckoo.to_record_major();
+    auto fused = cuckoo.answer_pir_fused_slices(a, N, 2);
+    for (size_t j = 0; j < 3; j++) {
+        hashdatastore::hash_type diff = _mm256_xor_si256(fused[j], expected[j]);
+        if (!_mm256_testz_si256(diff, diff)) {
+            std::cout << "record-major fused answer wrong\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int testAnswerKernels() {
+    // every supported kernel against answer_pir2, slice-major and record-major, with an odd slice
+    // count and records wider than the register-resident ones
+    std::mt19937_64 rng(21);
+    const hashdatastore::Kernel initial = hashdatastore::kernel();
+    for (size_t num_slice : {1, 2, 5, 11}) {
+        size_t num_rows = 2048 + 8 * 3;
+        hashdatastore store;
+        store.resize_data(num_slice);
+        for (size_t i = 0; i < num_rows; i++) {
+            for (size_t j = 0; j < num_slice; j++) {
+                store.data_s[j].push_back(_mm256_set_epi64x(rng(), rng(), rng(), rng()));
+            }
+        }
+        std::vector<uint8_t> query(num_rows / 8);
+        for (auto &byte : query) {
+            byte = rng();
+        }
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> expected;
+        for (size_t j = 0; j < num_slice; j++) {
+            expected.push_back(store.answer_pir2(query, j));
+        }
+        for (bool record_major : {false, true}) {
+            if (record_major)
+                store.to_record_major();
+            for (size_t k = 0; k < hashdatastore::NUM_KERNELS; k++) {
+                hashdatastore::Kernel kernel = static_cast<hashdatastore::Kernel>(k);
+                if (!hashdatastore::setKernel(kernel))
+                    continue;
+                auto answer = store.answer_pir_parallel_slices(query, 2);
+                for (size_t j = 0; j < num_slice; j++) {
+                    hashdatastore::hash_type diff = _mm256_xor_si256(answer[j], expected[j]);
+                    if (!_mm256_testz_si256(diff, diff)) {
+                        std::cout << hashdatastore::kernelName(kernel) << " answer wrong, " << num_slice << " slices"
+                                  << (record_major ? ", record-major" : "") << "\n";
+                        hashdatastore::setKernel(initial);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+    hashdatastore::setKernel(initial);
+    return 0;
+}
+
+int testAutotune() {
+    // the tuned kernel is pinned for its configuration only and answers like answer_pir2
+    std::mt19937_64 rng(22);
+    const hashdatastore::Kernel initial = hashdatastore::kernel();
+    const size_t num_slice = 3, num_rows = 4096;
+    hashdatastore store;
+    store.resize_data(num_slice);
+    for (size_t i = 0; i < num_rows; i++) {
+        for (size_t j = 0; j < num_slice; j++) {
+            store.data_s[j].push_back(_mm256_set_epi64x(rng(), rng(), rng(), rng()));
+        }
+    }
+    std::vector<uint8_t> query(num_rows / 8);
+    for (auto &byte : query) {
+        byte = rng();
+    }
+    for (bool record_major : {false, true}) {
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> expected;
+        for (size_t j = 0; j < num_slice && !record_major; j++) {
+            expected.push_back(store.answer_pir2(query, j));
+        }
+        if (record_major) {
+            expected = store.answer_pir_parallel_slices(query, 1);
+            store.to_record_major();
+        }
+        std::ostringstream log;
+        hashdatastore::Kernel tuned = store.autotune(2, &log, 64 << 10);
+        if (!hashdatastore::supports(tuned) || hashdatastore::kernel(record_major, num_slice, 2) != tuned ||
+            hashdatastore::kernel(record_major, num_slice, 3) != initial || log.str().find(hashdatastore::kernelName(tuned)) == std::string::npos) {
+            std::cout << "autotune did not pin " << hashdatastore::kernelName(tuned) << ": " << log.str();
+            hashdatastore::setKernel(initial);
+            return -1;
+        }
+        if (memcmp(store.answer_pir_parallel_slices(query, 2).data(), expected.data(), num_slice * sizeof(hashdatastore::hash_type)) != 0) {
+            std::cout << "autotuned " << hashdatastore::kernelName(tuned) << " answer wrong\n";
+            hashdatastore::setKernel(initial);
+            return -1;
+        }
+    }
+    // setKernel drops the pinned choices
+    hashdatastore::setKernel(initial);
+    if (hashdatastore::kernel(true, num_slice, 2) != initial) {
+        std::cout << "setKernel kept the autotuned kernel\n";
+        return -1;
+    }
+    return 0;
+}
+
+int testPlacement() {
+    // placed tables answer like the heap ones: both layouts, every page size (hugetlb pages may not
+    // be reserved, then place fails and the table stays), three partitions on the first node
+    std::mt19937_64 rng(24);
+    const size_t num_slice = 3, num_rows = 8192 + 8 * 5;
+    const int node = hashdatastore::numaNodes()[0];
+    for (bool record_major : {false, true}) {
+        for (hashdatastore::PageSize pages : {hashdatastore::PAGES_DEFAULT, hashdatastore::PAGES_TRANSPARENT, hashdatastore::PAGES_HUGETLB_2M}) {
+            for (hashdatastore::NumaPolicy numa : {hashdatastore::NUMA_DEFAULT, hashdatastore::NUMA_INTERLEAVE, hashdatastore::NUMA_PARTITION}) {
+                hashdatastore store;
+                store.resize_data(num_slice);
+                for (size_t i = 0; i < num_rows; i++) {
+                    for (size_t j = 0; j < num_slice; j++) {
+                        store.data_s[j].push_back(_mm256_set_epi64x(rng(), rng(), rng(), rng()));
+                    }
+                }
+                if (record_major)
+                    store.to_record_major();
+                std::vector<std::vector<uint8_t>> queries(3, std::vector<uint8_t>(num_rows / 8));
+                std::vector<const std::vector<uint8_t> *> indexings;
+                for (auto &query : queries) {
+                    for (auto &byte : query) {
+                        byte = rng();
+                    }
+                    indexings.push_back(&query);
+                }
+                std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> expected, answer;
+                store.answer_pir_batch_slices(indexings, 1, expected);
+                bool placed = store.place(pages, numa, {node, node, node});
+                if (pages != hashdatastore::PAGES_HUGETLB_2M && !placed) {
+                    std::cout << "place failed, pages " << pages << ", numa " << numa << "\n";
+                    return -1;
+                }
+                if (placed && (!store.data_s.empty() || store.record_major() != record_major || store.num_slice() != num_slice)) {
+                    std::cout << "placed table has the wrong shape\n";
+                    return -1;
+                }
+                // a 64 KB sample ends inside the first of the three partitions
+                if (placed && numa == hashdatastore::NUMA_PARTITION)
+                    store.autotune(2, nullptr, 1 << 16);
+                for (size_t num_threads : {1, 2, 5}) {
+                    store.answer_pir_batch_slices(indexings, num_threads, answer);
+                    if (memcmp(answer.data(), expected.data(), expected.size() * sizeof(hashdatastore::hash_type)) != 0) {
+                        std::cout << "placed answer wrong, pages " << pages << ", numa " << numa << ", " << num_threads << " threads"
+                                  << (record_major ? ", record-major" : "") << "\n";
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int testSizeClasses() {
+    // a few 4 KB outliers among short values get a class of their own, every record fits its class,
+    // and the overhead decides between one class per width and a single table
+    std::mt19937_64 rng(25);
+    std::vector<size_t> widths;
+    for (size_t i = 0; i < 20000; i++) {
+        widths.push_back(2 + rng() % 3);
+    }
+    widths.push_back(0);
+    for (size_t i = 0; i < 3; i++) {
+        widths.push_back(128);
+    }
+    std::shuffle(widths.begin(), widths.end(), rng);
+    std::vector<size_t> record_class;
+    std::vector<size_t> classes = hashdatastore::size_classes(widths, record_class);
+    size_t scanned = 0, real = 0;
+    std::vector<size_t> rows(classes.size());
+    for (size_t i = 0; i < widths.size(); i++) {
+        if (record_class[i] >= classes.size() || classes[record_class[i]] < std::max<size_t>(widths[i], 1)) {
+            std::cout << "record " << i << " does not fit its size class\n";
+            return -1;
+        }
+        rows[record_class[i]]++;
+        real += std::max<size_t>(widths[i], 1);
+    }
+    for (size_t c = 0; c < classes.size(); c++) {
+        scanned += (rows[c] + 7) / 8 * 8 * classes[c];
+    }
+    if (classes.back() != 128 || rows.back() != 3 || scanned > real * 3 / 2) {
+        std::cout << "size classes scan " << scanned << " slices for " << real << "\n";
+        return -1;
+    }
+    if (hashdatastore::size_classes(widths, record_class, 0).size() < 4 ||
+        hashdatastore::size_classes(widths, record_class, 1ULL << 40).size() != 1) {
+        std::cout << "size class overhead ignored\n";
+        return -1;
+    }
+    return 0;
+}
+
+int testSnapshot() {
+    std::mt19937_64 rng(17);
+    size_t num_rows = 1000;
+    std::string path = "/tmp/dpf_pir_test.snapshot";
+    for (bool record_major : {false, true}) {
+        hashdatastore store;
+        store.resize_data(3);
+        for (size_t i = 0; i < num_rows; i++) {
+            store.hashs_.push_back(rng() & store.HASH_MASK);
+            for (size_t j = 0; j < 3; j++) {
+                store.data_s[j].push_back(_mm256_set_epi64x(rng(), rng(), rng(), rng()));
+            }
+        }
+        if (record_major) {
+            store.to_record_major();
+        }
+        std::vector<uint8_t> query(num_rows / 8);
+        for (auto &byte : query) {
+            byte = rng();
+        }
+        if (!store.save_snapshot(path, 48, 1)) {
+            std::cout << "snapshot not written\n";
+            return -1;
+        }
+        hashdatastore loaded;
+        hashdatastore::snapshot_header header;
+        if (!loaded.load_snapshot(path, header) || header.logn != 48 || header.mode != 1 || loaded.hashs_ != store.hashs_ ||
+            loaded.num_slice() != 3 || loaded.record_major() != record_major) {
+            std::cout << "snapshot not loaded\n";
+            return -1;
+        }
+        auto expected = store.answer_pir_parallel_slices(query, 1);
+        auto answer = loaded.answer_pir_parallel_slices(query, 2);
+        for (size_t j = 0; j < 3; j++) {
+            hashdatastore::hash_type diff = _mm256_xor_si256(answer[j], expected[j]);
+            if (!_mm256_testz_si256(diff, diff)) {
+                std::cout << "snapshot answer wrong\n";
+                return -1;
+            }
+        }
+    }
+    hashdatastore loaded;
+    hashdatastore::snapshot_header header;
+    // a valid snapshot with one header field corrupted at a time; three slices take records of
+    // four, so that an odd stride of three still fits the file
+    hashdatastore store;
+    store.resize_data(3);
+    for (size_t i = 0; i < 8; i++) {
+        store.hashs_.push_back(i);
+        for (size_t j = 0; j < 3; j++) {
+            store.data_s[j].push_back(_mm256_set1_epi64x(i * 3 + j));
+        }
+    }
+    store.to_record_major();
+    for (int field = 0; field < 5; field++) {
+        if (!store.save_snapshot(path, 3, 0) || !loaded.load_snapshot(path, header)) {
+            std::cout << "snapshot not reloaded\n";
+            return -1;
+        }
+        if (field == 0) {
+            header.num_hashes = 7;
+        } else if (field == 1) {
+            header.row_stride = 1;
+            header.num_slice = 1ULL << 61;
+        } else if (field == 2) {
+            header.num_slice = header.row_stride + 1;
+        } else if (field == 3) {
+            header.row_stride = 3;
+        } else {
+            header.num_rows = 1ULL << 62;
+        }
+        std::fstream(path, std::ios::binary | std::ios::in | std::ios::out).write((const char *)&header, sizeof(header));
+        if (loaded.load_snapshot(path, header)) {
+            std::cout << "corrupt snapshot header " << field << " accepted\n";
+            return -1;
+        }
+    }
+    std::ofstream(path) << "not a snapshot";
+    if (loaded.load_snapshot(path, header) || loaded.load_snapshot("/nonexistent/snapshot", header)) {
+        std::cout << "invalid snapshot accepted\n";
+        return -1;
+    }
+    std::remove(path.c_str());
+    return 0;
+}
+
 int main(int argc, char** argv) {
     int res = 0;
+    res |= testAESImpl();
     res |= testEvalFull8();
     res |= testCorr();
+    res |= testEvalPoints();
+    res |= testParsedKey();
+    res |= testLeafWidth();
+    res |= testGenBatch();
+    res |= testCompactKey();
+    res |= testCuckoo();
+    res |= testEvalFullParallel();
+    res |= testEvalFullMany();
+    res |= testEvalFullIterative();
+    res |= testEvalFullChunked();
+    res |= testFixedDepth();
+    res |= testAnswerFused();
+    res |= testAnswerBatch();
+    res |= testAnswerParallel();
+    res |= testRecordMajor();
+    res |= testAnswerKernels();
+    res |= testAutotune();
+    res |= testPlacement();
+    res |= testSizeClasses();
+    res |= testSnapshot();
     return res;
 }
\ No newline at end of file
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <iostream>
+#include <grpc/grpc.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/client_context.h>
+
+#include "dpf_pir.grpc.pb.h"
+#include "dpf.h"
+#include "hashdatastore.h"
+#include <immintrin.h>
+#include <cassert>
+
+using namespace std;
+using dpfpir::Answer;
+using dpfpir::DPFPIRInterface;
+using dpfpir::FuncKey;
+using dpfpir::Info;
+using dpfpir::KeywordMode;
+using dpfpir::Params;
+using grpc::Channel;
+using grpc::ClientContext;
+using grpc::ClientReader;
+using grpc::ClientWriter;
+using grpc::Status;
+
+class DpfPirClient
+{
+public:
+    string client_id;
+    size_t num_slice;
+    size_t logN;
+    KeywordMode mode;
+    size_t num_hash;
+
+    std::unique_ptr<DPFPIRInterface::Stub> stub_;
+    string serverAddr;
+
+public:
+    explicit DpfPirClient(std::shared_ptr<Channel> channel, string &client_id, string serverAddr) : stub_(DPFPIRInterface::NewStub(channel)), client_id(client_id), serverAddr(serverAddr){};
+
+    void DpfParams()
+    {
+        Info request;
+        Params reply;
+        ClientContext context;
+        context.AddMetadata("client_id", this->client_id);
+
+        Status status = stub_->DpfParams(&context, request, &reply);
+        if (status.ok())
+        {
+            this->logN = reply.logn();
+            this->num_slice = reply.num_slice();
+            this->mode = reply.mode();
+            this->num_hash = reply.num_hash();
+            return;
+        }
+        else
+        {
+            std::cout << "RPC failed" << std::endl;
+            std::cout << status.error_code() << ": " << status.error_message()
+                      << std::endl;
+            return;
+        }
+    }
+
+    static void checkParams(DpfPirClient &client0, DpfPirClient &client1)
+    {
+        assert(client0.logN == client1.logN);
+        assert(client0.num_slice == client1.num_slice);
+        assert(client0.mode == client1.mode);
+        assert(client0.num_hash == client1.num_hash);
+    }
+
+    static std::pair<std::vector<uint8_t>, std::vector<uint8_t>> GenFuncKeys(string &query_keyword, size_t logN)
+    {
+        uint64_t HASH_MASK = (1ULL << logN) - 1;
+        std::hash<std::string> hashFunction;
+        size_t query_index = hashFunction(query_keyword) & HASH_MASK; // 48 bits
+        std::pair<std::vector<uint8_t>, std::vector<uint8_t>> keys = DPF::Gen(query_index, logN);
+        // sent in the compact format, the server accepts both
+        return std::make_pair(DPF::CompactKey(keys.first, logN), DPF::CompactKey(keys.second, logN));
+    }
+
+    // one key pair per cuckoo candidate bucket of query_keyword
+    static std::pair<std::vector<std::vector<uint8_t>>, std::vector<std::vector<uint8_t>>> GenCuckooFuncKeys(string &query_keyword, size_t logN, size_t num_hash)
+    {
+        std::pair<std::vector<std::vector<uint8_t>>, std::vector<std::vector<uint8_t>>> keys;
+        for (size_t h = 0; h < num_hash; h++)
+        {
+            size_t query_index = hashdatastore::cuckoo_bucket(query_keyword, h, logN);
+            std::pair<std::vector<uint8_t>, std::vector<uint8_t>> key = DPF::Gen(query_index, logN);
+            keys.first.push_back(DPF::CompactKey(key.first, logN));
+            keys.second.push_back(DPF::CompactKey(key.second, logN));
+        }
+        return keys;
+    }
+
+    std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> DpfPir(std::vector<uint8_t> &funckey)
+    {
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> result;
+
+        FuncKey request;
+        Answer reply;
+        ClientContext context;
+        context.AddMetadata("client_id", this->client_id);
+
+        /* set funckey */
+        string key_str(funckey.begin(), funckey.end());
+        request.set_funckey(key_str);
+
+        Status status = stub_->DpfPir(&context, request, &reply);
+
+        if (status.ok())
+        {
+
+            std::cout << "[" << this->client_id << "][" << this->serverAddr << "] "
+                      << "3.Receive PIR result." << std::endl;
+            for (size_t i = 0; i < this->num_slice; i++)
+            {
+                result.push_back(stringToM256i(reply.answer().substr(i * 32, 32)));
+            }
+        }
+        else
+        {
+            std::cout << "RPC failed" << std::endl;
+            std::cout << status.error_code() << ": " << status.error_message()
+                      << std::endl;
+            for (size_t i = 0; i < this->num_slice; i++)
+            {
+                result.push_back(__m256i());
+            }
+        }
+        return result;
+    }
+
+    static string Reconstruction(std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> &answer0, std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> &answer1, size_t num_slice)
+    {
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer;
+        for (size_t i = 0; i < num_slice; i++)
+        {
+            answer.push_back(_mm256_xor_si256(answer0[i], answer1[i]));
+        }
+        std::string answer_str;
+        for (size_t i = 0; i < num_slice; i++)
+        {
+            answer_str += DpfPirClient::m256i2string(answer[i]);
+        }
+        return answer_str;
+    }
+
+    // answers hold num_slice value slices plus one fingerprint slice per candidate bucket;
+    // the bucket whose fingerprint matches query_keyword holds the value
+    static string ReconstructionCuckoo(std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> &answer0, std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> &answer1, size_t num_slice, size_t num_hash, string &query_keyword)
+    {
+        uint64_t fingerprint = hashdatastore::cuckoo_fingerprint(query_keyword);
+        for (size_t h = 0; h < num_hash; h++)
+        {
+            size_t base = h * (num_slice + 1);
+            hashdatastore::hash_type fp = _mm256_xor_si256(answer0[base + num_slice], answer1[base + num_slice]);
+            if (static_cast<uint64_t>(_mm256_extract_epi64(fp, 0)) != fingerprint)
+                continue;
+            std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> value0(answer0.begin() + base, answer0.begin() + base + num_slice);
+            std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> value1(answer1.begin() + base, answer1.begin() + base + num_slice);
+            return Reconstruction(value0, value1, num_slice);
+        }
+        return "";
+    }
+
+public: // for parallel
+    // Convert string to __m256i
+    __m256i stringToM256i(const std::string &str)
+    {
+        __m256i result;
+        alignas(32) uint8_t buffer[32];
+
+        // Ensure the string is large enough to fill the buffer
+        if (str.size() >= sizeof(buffer))
+        {
+            // Copy characters from the string to the buffer
+            for (size_t i = 0; i < sizeof(buffer); ++i)
+            {
+                buffer[i] = static_cast<uint8_t>(str[i]);
+            }
+
+            // Load the buffer into the __m256i variable
+            result = _mm256_load_si256((__m256i *)buffer);
+        }
+        else
+        {
+            // Handle the case where the string is too short
+            std::cerr << "Error: String is too short to convert to __m256i." << std::endl;
+            // You might want to handle this differently based on your requirements
+        }
+
+        return result;
+    }
+
+private:
+    static string m256i2string(hashdatastore::hash_type value)
+    {
+        std::string result;
+        size_t re0 = _mm256_extract_epi64(value, 3);
+        size_t re1 = _mm256_extract_epi64(value, 2);
+        size_t re2 = _mm256_extract_epi64(value, 1);
+        size_t re3 = _mm256_extract_epi64(value, 0);
+        for (size_t j = 0; j < 8; j++)
+        {
+            unsigned char byte = (re0 >> (j * 8)) & 0xFF;
+            result += static_cast<char>(byte);
+        }
+        for (size_t j = 0; j < 8; j++)
+        {
+            unsigned char byte = (re1 >> (j * 8)) & 0xFF;
+            result += static_cast<char>(byte);
+        }
+        for (size_t j = 0; j < 8; j++)
+        {
+            unsigned char byte = (re2 >> (j * 8)) & 0xFF;
+            result += static_cast<char>(byte);
+        }
+        for (size_t j = 0; j < 8; j++)
+        {
+            unsigned char byte = (re3 >> (j * 8)) & 0xFF;
+            result += static_cast<char>(byte);
+        }
+        return result;
+    }
+};
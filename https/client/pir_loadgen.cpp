@@ -0,0 +1,301 @@
+#include "client.h"
+#include <boost/program_options.hpp>
+#include <grpcpp/completion_queue.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <cstring>
+#include <thread>
+
+namespace po = boost::program_options;
+using Clock = std::chrono::steady_clock;
+
+// Load generator: keeps one channel per server open and issues PIR queries for the keywords of a
+// file, either closed-loop (--concurrency queries in flight) or open-loop at a --qps target, then
+// reports throughput and latency percentiles for Gen, the RPC to each server and reconstruction.
+
+enum Phase
+{
+    PHASE_GEN,
+    PHASE_RPC0,
+    PHASE_RPC1,
+    PHASE_RECONSTRUCT,
+    PHASE_TOTAL,
+    NUM_PHASE
+};
+static const char *PHASE_NAMES[NUM_PHASE] = {"gen", "rpc0", "rpc1", "reconstruct", "total"};
+
+struct Samples
+{
+    std::vector<double> us[NUM_PHASE]; // microseconds
+    size_t errors = 0;
+    size_t not_found = 0;
+};
+
+static double elapsedUs(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double, std::micro>(to - from).count();
+}
+
+// nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static void parseAnswer(const Answer &reply, size_t num_answer, std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> &ans)
+{
+    ans.assign(num_answer, _mm256_setzero_si256());
+    for (size_t i = 0; i < num_answer && (i + 1) * 32 <= reply.answer().size(); i++)
+    {
+        memcpy(&ans[i], reply.answer().data() + i * 32, 32);
+    }
+}
+
+// one query: both RPCs go out together on the worker's completion queue, each is timed until its
+// own completion; scheduled is when the query should have started (open-loop), so queueing delay
+// on the client side counts towards the total
+static void runQuery(DpfPirClient &rpc0, DpfPirClient &rpc1, grpc::CompletionQueue &cq, string &keyword, Clock::time_point scheduled, Samples &samples)
+{
+    const bool cuckoo = rpc0.mode == dpfpir::KEYWORD_CUCKOO;
+    Clock::time_point t0 = Clock::now();
+    FuncKey request[2];
+    if (cuckoo)
+    {
+        auto keys = DpfPirClient::GenCuckooFuncKeys(keyword, rpc0.logN, rpc0.num_hash);
+        for (size_t h = 0; h < keys.first.size(); h++)
+        {
+            request[0].add_cuckoo_funckeys(string(keys.first[h].begin(), keys.first[h].end()));
+            request[1].add_cuckoo_funckeys(string(keys.second[h].begin(), keys.second[h].end()));
+        }
+    }
+    else
+    {
+        auto keys = DpfPirClient::GenFuncKeys(keyword, rpc0.logN);
+        request[0].set_funckey(string(keys.first.begin(), keys.first.end()));
+        request[1].set_funckey(string(keys.second.begin(), keys.second.end()));
+    }
+    Clock::time_point t1 = Clock::now();
+
+    DpfPirClient *rpc[2] = {&rpc0, &rpc1};
+    ClientContext context[2];
+    Answer reply[2];
+    Status status[2];
+    std::unique_ptr<grpc::ClientAsyncResponseReader<Answer>> call[2];
+    for (size_t s = 0; s < 2; s++)
+    {
+        context[s].AddMetadata("client_id", rpc[s]->client_id);
+        call[s] = rpc[s]->stub_->AsyncDpfPir(&context[s], request[s], &cq);
+        call[s]->Finish(&reply[s], &status[s], reinterpret_cast<void *>(s));
+    }
+    Clock::time_point done[2];
+    for (size_t n = 0; n < 2; n++)
+    {
+        void *tag;
+        bool ok;
+        cq.Next(&tag, &ok);
+        done[reinterpret_cast<size_t>(tag)] = Clock::now();
+    }
+
+    size_t num_answer = cuckoo ? rpc0.num_hash * (rpc0.num_slice + 1) : rpc0.num_slice;
+    std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer0, answer1;
+    parseAnswer(reply[0], num_answer, answer0);
+    parseAnswer(reply[1], num_answer, answer1);
+    Clock::time_point t2 = Clock::now();
+    string answer_str = cuckoo ? DpfPirClient::ReconstructionCuckoo(answer0, answer1, rpc0.num_slice, rpc0.num_hash, keyword)
+                               : DpfPirClient::Reconstruction(answer0, answer1, rpc0.num_slice);
+    Clock::time_point t3 = Clock::now();
+
+    if (!status[0].ok() || !status[1].ok())
+    {
+        samples.errors++;
+        return;
+    }
+    if (answer_str.empty()) // only cuckoo mode can tell that a keyword is missing
+        samples.not_found++;
+    samples.us[PHASE_GEN].push_back(elapsedUs(t0, t1));
+    samples.us[PHASE_RPC0].push_back(elapsedUs(t1, done[0]));
+    samples.us[PHASE_RPC1].push_back(elapsedUs(t1, done[1]));
+    samples.us[PHASE_RECONSTRUCT].push_back(elapsedUs(t2, t3));
+    samples.us[PHASE_TOTAL].push_back(elapsedUs(std::min(scheduled, t0), t3));
+}
+
+int main(int argc, char *argv[])
+{
+#pragma region args
+    /* args */
+    string client_id;
+    string serverAddr0;
+    string serverAddr1;
+    string keyword_path;
+    string json_path;
+    size_t concurrency;
+    double qps = 0;
+    double duration;
+    size_t max_queries = 0;
+    try
+    {
+        // def options
+        po::options_description desc("Allowed options");
+        desc.add_options()("help,h", "Produce help message")("id", po::value<std::string>()->default_value("loadgen"), "client id (string)")("server0", po::value<std::string>()->default_value("localhost:50053"), "address of server 0")("server1", po::value<std::string>()->default_value("localhost:50054"), "address of server 1")("keywords", po::value<std::string>()->required(), "file with one query keyword per line, used round-robin")("concurrency", po::value<size_t>()->default_value(1), "queries in flight")("qps", po::value<double>(), "open-loop target rate, queries start on a fixed schedule (default: closed-loop)")("duration", po::value<double>()->default_value(10), "seconds to run")("queries", po::value<size_t>(), "stop after this many queries")("json", po::value<std::string>(), "also write the report as JSON to this file (- for stdout)");
+
+        // parse params
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        // result
+        if (vm.count("help"))
+        {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+
+        client_id = vm["id"].as<std::string>();
+        serverAddr0 = vm["server0"].as<std::string>();
+        serverAddr1 = vm["server1"].as<std::string>();
+        keyword_path = vm["keywords"].as<std::string>();
+        concurrency = vm["concurrency"].as<size_t>();
+        duration = vm["duration"].as<double>();
+        if (vm.count("qps"))
+            qps = vm["qps"].as<double>();
+        if (vm.count("queries"))
+            max_queries = vm["queries"].as<size_t>();
+        if (vm.count("json"))
+            json_path = vm["json"].as<std::string>();
+        if (concurrency == 0 || qps < 0)
+            throw std::invalid_argument("concurrency and qps must be positive");
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+#pragma endregion args
+
+    std::vector<string> keywords;
+    std::ifstream keyword_file(keyword_path);
+    for (string line; std::getline(keyword_file, line);)
+    {
+        if (!line.empty())
+            keywords.push_back(line);
+    }
+    if (keywords.empty())
+    {
+        std::cerr << "Error: no keywords in " << keyword_path << std::endl;
+        return 1;
+    }
+
+    /* RPC, channels stay open for the whole run */
+    DpfPirClient rpc_client0(grpc::CreateChannel(serverAddr0, grpc::InsecureChannelCredentials()), client_id, serverAddr0);
+    DpfPirClient rpc_client1(grpc::CreateChannel(serverAddr1, grpc::InsecureChannelCredentials()), client_id, serverAddr1);
+    rpc_client0.DpfParams();
+    rpc_client1.DpfParams();
+    DpfPirClient::checkParams(rpc_client0, rpc_client1);
+
+    /* run */
+    std::atomic<size_t> next(0);
+    std::mutex mu;
+    Samples all;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration));
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < concurrency; w++)
+    {
+        workers.emplace_back([&]
+                             {
+            grpc::CompletionQueue cq;
+            Samples samples;
+            while (true)
+            {
+                size_t i = next++;
+                if (max_queries != 0 && i >= max_queries)
+                    break;
+                Clock::time_point scheduled = Clock::now();
+                if (qps > 0)
+                {
+                    scheduled = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(i / qps));
+                    std::this_thread::sleep_until(scheduled);
+                }
+                if (scheduled >= deadline)
+                    break;
+                runQuery(rpc_client0, rpc_client1, cq, keywords[i % keywords.size()], scheduled, samples);
+            }
+            std::lock_guard<std::mutex> lock(mu);
+            for (size_t p = 0; p < NUM_PHASE; p++)
+            {
+                all.us[p].insert(all.us[p].end(), samples.us[p].begin(), samples.us[p].end());
+            }
+            all.errors += samples.errors;
+            all.not_found += samples.not_found; });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    double elapsed = elapsedUs(start, Clock::now()) / 1e6;
+
+    /* report */
+    size_t completed = all.us[PHASE_TOTAL].size();
+    for (size_t p = 0; p < NUM_PHASE; p++)
+    {
+        std::sort(all.us[p].begin(), all.us[p].end());
+    }
+    const double pcts[] = {50, 90, 99, 99.9};
+    const char *pct_names[] = {"p50", "p90", "p99", "p999"};
+
+    std::cout << "mode " << (rpc_client0.mode == dpfpir::KEYWORD_CUCKOO ? "cuckoo" : "hash") << ", ";
+    if (qps > 0)
+        std::cout << "open-loop " << qps << " qps";
+    else
+        std::cout << "closed-loop";
+    std::cout << ", concurrency " << concurrency << std::endl;
+    std::cout << completed << " queries in " << elapsed << "sec: " << completed / elapsed << " queries/sec, "
+              << all.errors << " errors, " << all.not_found << " not found" << std::endl;
+    std::printf("%-12s %10s %10s %10s %10s %10s\n", "latency(us)", "mean", "p50", "p90", "p99", "p999");
+    for (size_t p = 0; p < NUM_PHASE; p++)
+    {
+        double mean = 0;
+        for (double v : all.us[p])
+        {
+            mean += v;
+        }
+        mean = all.us[p].empty() ? 0 : mean / all.us[p].size();
+        std::printf("%-12s %10.1f %10.1f %10.1f %10.1f %10.1f\n", PHASE_NAMES[p], mean, percentile(all.us[p], 50),
+                    percentile(all.us[p], 90), percentile(all.us[p], 99), percentile(all.us[p], 99.9));
+    }
+
+    if (!json_path.empty())
+    {
+        std::ostringstream json;
+        json << "{\"mode\": \"" << (rpc_client0.mode == dpfpir::KEYWORD_CUCKOO ? "cuckoo" : "hash") << "\", "
+             << "\"qps_target\": " << qps << ", \"concurrency\": " << concurrency << ", "
+             << "\"queries\": " << completed << ", \"errors\": " << all.errors << ", \"not_found\": " << all.not_found << ", "
+             << "\"seconds\": " << elapsed << ", \"throughput_qps\": " << completed / elapsed << ", \"latency_us\": {";
+        for (size_t p = 0; p < NUM_PHASE; p++)
+        {
+            json << (p ? ", " : "") << "\"" << PHASE_NAMES[p] << "\": {";
+            for (size_t k = 0; k < 4; k++)
+            {
+                json << (k ? ", " : "") << "\"" << pct_names[k] << "\": " << percentile(all.us[p], pcts[k]);
+            }
+            json << "}";
+        }
+        json << "}}" << std::endl;
+        if (json_path == "-")
+        {
+            std::cout << json.str();
+        }
+        else
+        {
+            std::ofstream(json_path) << json.str();
+        }
+    }
+    return all.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "hashdatastore.h"
+#include <nlohmann/json.hpp>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Building the server's hashdatastore from a {keyword: value} JSON file, shared by the server and
+// json2snapshot.
+
+inline std::vector<std::string> str2vecstr(std::string s, size_t num_slice)
+{
+    std::vector<std::string> result;
+    size_t n = s.size();
+    for (size_t i = 0; i < num_slice; i++)
+    {
+        if (n > 32)
+        {
+            result.push_back(s.substr(i * 32, 32));
+            n = n - 32;
+        }
+        else
+        {
+            result.push_back(s.substr(i * 32, n));
+            break;
+        }
+    }
+    if (result.size() < num_slice)
+    {
+        result.resize(num_slice);
+    }
+    return result;
+}
+
+inline size_t getnum(std::vector<std::string> &s)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i].size() > n)
+        {
+            n = s[i].size();
+        }
+    }
+    if (n % 32 == 0)
+    {
+        return n / 32;
+    }
+    return n / 32 + 1;
+}
+
+inline bool readJsonData(const std::string &json_data_path, std::vector<std::string> &db_keys, std::vector<std::string> &db_elems)
+{
+    std::ifstream file(json_data_path);
+    if (!file.is_open())
+    {
+        std::cerr << "Error opening file.\n";
+        return false;
+    }
+
+    nlohmann::json jsonData;
+    file >> jsonData;
+
+    for (auto it = jsonData.begin(); it != jsonData.end(); ++it)
+    {
+        db_keys.push_back(it.key());
+        db_elems.push_back(it.value());
+    }
+    return true;
+}
+
+// 48-bit keyword hashes, padded to a multiple of 8 rows and sorted for DPF::EvalPoints
+inline void buildHashTable(hashdatastore &db, std::vector<std::string> &db_keys, std::vector<std::string> &db_elems, size_t num_slice)
+{
+    const size_t db_size = db_keys.size();
+    db.resize_data(num_slice);
+    // Fill Datastore
+    for (size_t i = 0; i < db_size; i++)
+    {
+        db.push_back(db_keys[i], hashdatastore::KeywordType::HASH, str2vecstr(db_elems[i], num_slice), num_slice);
+    }
+    // Pad
+    if (db_size % 8 != 0)
+    {
+        std::vector<std::string> emp;
+        for (size_t i = 0; i < num_slice; i++)
+        {
+            emp.push_back("");
+        }
+        for (size_t i = 0; i < (8 - db_size % 8); i++)
+        {
+            db.push_back("", hashdatastore::KeywordType::HASH, emp, num_slice);
+        }
+    }
+    // EvalPoints walks the hashes in ascending order
+    db.sort_by_hash();
+}
+
+// buildHashTable per size class: records of similar length share a table padded only to the
+// longest of them, tables[c] holds the records of widths[c] slices. returns the widths
+inline std::vector<size_t> buildSizeClassTables(std::vector<hashdatastore> &tables, std::vector<std::string> &db_keys, std::vector<std::string> &db_elems)
+{
+    std::vector<size_t> widths, record_class;
+    size_t slices = 0;
+    for (const std::string &elem : db_elems)
+    {
+        widths.push_back((elem.size() + 31) / 32);
+        slices += std::max<size_t>(widths.back(), 1);
+    }
+    std::vector<size_t> class_widths = hashdatastore::size_classes(widths, record_class);
+    std::vector<std::vector<std::string>> class_keys(class_widths.size()), class_elems(class_widths.size());
+    for (size_t i = 0; i < db_keys.size(); i++)
+    {
+        class_keys[record_class[i]].push_back(db_keys[i]);
+        class_elems[record_class[i]].push_back(db_elems[i]);
+    }
+    tables.clear();
+    tables.resize(class_widths.size());
+    size_t scanned = 0;
+    for (size_t c = 0; c < class_widths.size(); c++)
+    {
+        buildHashTable(tables[c], class_keys[c], class_elems[c], class_widths[c]);
+        scanned += tables[c].hashs_.size() * class_widths[c];
+        std::cout << "Size class " << c << ": " << class_keys[c].size() << " records of up to " << 32 * class_widths[c] << " B" << std::endl;
+    }
+    std::cout << "Size classes scan " << 32 * scanned << " B per query for " << 32 * slices << " B of slices ("
+              << 32 * db_elems.size() * getnum(db_elems) << " B in one table)" << std::endl;
+    return class_widths;
+}
+
+// cuckoo table of 2^logN buckets, returns logN
+inline bool buildCuckooTable(hashdatastore &db, std::vector<std::string> &db_keys, std::vector<std::string> &db_elems, size_t num_slice, size_t &logN)
+{
+    const size_t db_size = db_keys.size();
+    std::vector<std::vector<std::string>> db_slices;
+    for (size_t i = 0; i < db_size; i++)
+    {
+        db_slices.push_back(str2vecstr(db_elems[i], num_slice));
+    }
+    // smallest table (at least 2^10 for EvalFull8) below 85% load, grown until insertion settles.
+    // a few doublings settle any real input (duplicate keywords never do), and the DPF domain ends
+    // at 2^63
+    logN = 10;
+    while (logN < 63 && ((1ULL << logN) - 1) * 0.85 < db_size)
+    {
+        logN++;
+    }
+    const size_t max_logN = std::min<size_t>(63, logN + 4);
+    while (!db.build_cuckoo(db_keys, db_slices, num_slice, logN))
+    {
+        if (logN == max_logN)
+        {
+            std::cerr << "Cuckoo insertion of " << db_size << " keywords failed up to 2^" << logN << " buckets (duplicate keywords?)" << std::endl;
+            return false;
+        }
+        logN++;
+    }
+    std::cout << "Cuckoo table: 2^" << logN << " buckets for " << db_size << " keywords" << std::endl;
+    return true;
+}
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <stdexcept> // throw
+#include <chrono>
+
+#include "hashdatastore.h"
+#include "database.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+// keyword modes as in dpf_pir.proto
+static const uint64_t KEYWORD_HASH = 0;
+static const uint64_t KEYWORD_CUCKOO = 1;
+
+int main(int argc, char *argv[])
+{
+#pragma region args
+    /* args */
+    string json_path;
+    string snapshot_path;
+    uint64_t mode = KEYWORD_HASH;
+    bool record_major = false;
+    try
+    {
+        // def options
+        po::options_description desc("Allowed options");
+        desc.add_options()("help,h", "Produce help message")("json", po::value<std::string>()->required(), "input JSON data")("out", po::value<std::string>()->required(), "output snapshot")("mode", po::value<std::string>()->default_value("hash"), "keyword mode (hash/cuckoo)")("layout", po::value<std::string>()->default_value("slice"), "table layout (slice/record)");
+
+        // parse params
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        // result
+        if (vm.count("help"))
+        {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+
+        json_path = vm["json"].as<std::string>();
+        snapshot_path = vm["out"].as<std::string>();
+
+        if (vm["mode"].as<std::string>() == "cuckoo")
+            mode = KEYWORD_CUCKOO;
+        else if (vm["mode"].as<std::string>() != "hash")
+            throw std::invalid_argument("Invalid mode: " + vm["mode"].as<std::string>());
+
+        if (vm["layout"].as<std::string>() == "record")
+            record_major = true;
+        else if (vm["layout"].as<std::string>() != "slice")
+            throw std::invalid_argument("Invalid layout: " + vm["layout"].as<std::string>());
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+#pragma endregion args
+
+    auto time0 = std::chrono::high_resolution_clock::now();
+    std::vector<std::string> db_keys;
+    std::vector<std::string> db_elems;
+    if (!readJsonData(json_path, db_keys, db_elems))
+        return 1;
+
+    hashdatastore db;
+    size_t num_slice = getnum(db_elems);
+    size_t logN = 48; // 48 bit hash, as in the server
+    if (mode == KEYWORD_CUCKOO)
+    {
+        if (!buildCuckooTable(db, db_keys, db_elems, num_slice, logN))
+            return 1;
+    }
+    else
+        buildHashTable(db, db_keys, db_elems, num_slice);
+    if (record_major)
+        db.to_record_major();
+
+    if (!db.save_snapshot(snapshot_path, logN, mode))
+    {
+        std::cerr << "Error writing " << snapshot_path << std::endl;
+        return 1;
+    }
+    auto time1 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> convertT = time1 - time0;
+    std::cout << db_keys.size() << " keywords, " << num_slice << " slices written to " << snapshot_path << " in " << convertT.count() << "sec" << std::endl;
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include "dpf_pir.grpc.pb.h"
 #include "dpf.h"
 #include "hashdatastore.h"
+#include "database.h"
 #include <immintrin.h> // Include the necessary header for
 #include <boost/program_options.hpp>
 #include <stdexcept> // throw
@@ -15,6 +16,11 @@
 #include <fstream>
 #include <nlohmann/json.hpp>
 #include <bitset>
+#include <thread>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+#include <set>
 
 namespace po = boost::program_options;
 using json = nlohmann::json;
@@ -23,6 +29,7 @@ using dpfpir::Answer;
 using dpfpir::DPFPIRInterface;
 using dpfpir::FuncKey;
 using dpfpir::Info;
+using dpfpir::KeywordMode;
 using dpfpir::Params;
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -32,28 +39,190 @@ using grpc::ServerWriter;
 using grpc::Status;
 using grpc::StatusCode;
 
+// Coalesces concurrent DpfPir calls into one hashdatastore::answer_pir_batch_slices pass per table.
+// Whoever finds no batch running becomes the leader and answers everything queued so far (up to
+// max_batch calls); calls arriving meanwhile wait and form the next batch. DPF keys (cuckoo mode,
+// a single table) of all calls in a batch are expanded together by one DPF::EvalFullMany.
+class QueryBatcher
+{
+private:
+    struct Pending
+    {
+        const std::vector<std::vector<uint8_t>> *queries; // a selection vector per table, or
+        const std::vector<std::vector<uint8_t>> *keys; // DPF keys, one selection vector each
+        size_t logn;
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> *answer;
+        bool done;
+    };
+
+    const std::vector<hashdatastore> &tables;
+    size_t max_batch;
+    size_t num_threads;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Pending *> queue_;
+    bool running_ = false;
+
+    void run(const std::vector<Pending *> &batch)
+    {
+        std::vector<std::vector<uint8_t>> keys;
+        size_t logn = 0;
+        for (Pending *p : batch)
+        {
+            if (p->keys)
+            {
+                keys.insert(keys.end(), p->keys->begin(), p->keys->end());
+                logn = p->logn;
+            }
+        }
+        std::vector<std::vector<uint8_t>> full;
+        std::vector<const std::vector<uint8_t> *> queries;
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> out;
+        if (!keys.empty())
+        {
+            full = DPF::EvalFullMany(keys, logn, num_threads);
+            for (const std::vector<uint8_t> &query : full)
+            {
+                queries.push_back(&query);
+            }
+            tables[0].answer_pir_batch_slices(queries, num_threads, out);
+            const size_t num_slice = tables[0].num_slice();
+            size_t q = 0;
+            for (Pending *p : batch)
+            {
+                if (!p->keys)
+                    continue;
+                p->answer->assign(out.begin() + q * num_slice, out.begin() + (q + p->keys->size()) * num_slice);
+                q += p->keys->size();
+            }
+        }
+
+        // selection vectors are answered on every table and the answers XORed into one as wide as
+        // the widest table, narrower ones zero-extended: only the size class holding the keyword
+        // selects anything, and the XOR of shares is still a share
+        size_t width = 0;
+        for (const hashdatastore &table : tables)
+        {
+            width = std::max(width, table.num_slice());
+        }
+        for (Pending *p : batch)
+        {
+            if (p->queries)
+                p->answer->assign(width, _mm256_setzero_si256());
+        }
+        for (size_t c = 0; c < tables.size(); c++)
+        {
+            queries.clear();
+            for (Pending *p : batch)
+            {
+                if (p->queries)
+                    queries.push_back(&(*p->queries)[c]);
+            }
+            if (queries.empty())
+                break;
+            tables[c].answer_pir_batch_slices(queries, num_threads, out);
+            const size_t num_slice = tables[c].num_slice();
+            size_t q = 0;
+            for (Pending *p : batch)
+            {
+                if (!p->queries)
+                    continue;
+                for (size_t j = 0; j < num_slice; j++)
+                {
+                    (*p->answer)[j] = _mm256_xor_si256((*p->answer)[j], out[q * num_slice + j]);
+                }
+                q++;
+            }
+        }
+    }
+
+    // queues pending and blocks until its batch is answered
+    void submit(Pending &pending)
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        queue_.push_back(&pending);
+        while (!pending.done)
+        {
+            if (running_)
+            {
+                cv_.wait(lock);
+                continue;
+            }
+            running_ = true;
+            std::vector<Pending *> batch;
+            while (!queue_.empty() && batch.size() < max_batch)
+            {
+                batch.push_back(queue_.front());
+                queue_.pop_front();
+            }
+            lock.unlock();
+            run(batch);
+            lock.lock();
+            for (Pending *p : batch)
+            {
+                p->done = true;
+            }
+            running_ = false;
+            cv_.notify_all();
+        }
+    }
+
+public:
+    QueryBatcher(const std::vector<hashdatastore> &tables, size_t max_batch, size_t num_threads) : tables(tables), max_batch(max_batch), num_threads(num_threads){};
+    // threads a batch is evaluated and answered with, set before serving
+    void setThreads(size_t num_threads) { this->num_threads = num_threads; }
+    size_t threads() const { return num_threads; }
+
+    // blocks until queries (one per table) are answered, returns one answer per slice of the widest table
+    std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer(const std::vector<std::vector<uint8_t>> &queries)
+    {
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer;
+        Pending pending = {&queries, nullptr, 0, &answer, false};
+        submit(pending);
+        return answer;
+    }
+
+    // blocks until the full-domain queries of keys are answered, returns one answer per key and slice
+    std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer(const std::vector<std::vector<uint8_t>> &keys, size_t logn)
+    {
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer;
+        Pending pending = {nullptr, &keys, logn, &answer, false};
+        submit(pending);
+        return answer;
+    }
+};
+
 class DpfPirImpl final : public DPFPIRInterface::Service
 {
 private:
     std::mutex mu_;
     uint8_t server_id;
     size_t logN; // number of keyword bits
-    hashdatastore db;
+    // hash mode: one table per size class (see buildSizeClassTables), cuckoo mode: one table
+    std::vector<hashdatastore> tables = std::vector<hashdatastore>(1);
     size_t db_size;
     size_t num_slice; // num_value_slice
+    KeywordMode mode = dpfpir::KEYWORD_HASH;
+    size_t num_threads = std::thread::hardware_concurrency(); // for DPF evaluation and answering
+    QueryBatcher batcher{tables, 32, num_threads};
+    bool verbose = true; // per-call progress output
 
 public:
+    void setVerbose(bool verbose) { this->verbose = verbose; }
+    void setBatchThreads(size_t num_threads) { batcher.setThreads(num_threads); }
+
     DpfPirImpl(uint8_t server_id, size_t logN, vector<string> &db_keys, vector<string> &db_elems) : server_id(server_id), logN(logN)
     {
         assert(db_keys.size() <= ((1ULL << logN) - 1));
         assert(db_keys.size() == db_elems.size());
         this->db_size = db_keys.size();
         this->num_slice = getnum(db_elems);
+        hashdatastore &db = tables[0];
         db.resize_data(num_slice);
         // Fill Datastore
         for (size_t i = 0; i < db_size; i++)
         {
-            this->db.push_back(db_keys[i], hashdatastore::KeywordType::STRING, str2vecstr(db_elems[i], num_slice), num_slice);
+            db.push_back(db_keys[i], hashdatastore::KeywordType::STRING, str2vecstr(db_elems[i], num_slice), num_slice);
         }
         // Pad
         if (db_size % 8 != 0)
@@ -65,88 +234,122 @@ public:
             }
             for (size_t i = 0; i < (8 - db_size % 8); i++)
             {
-                this->db.push_back("", hashdatastore::KeywordType::STRING, emp, num_slice);
+                db.push_back("", hashdatastore::KeywordType::STRING, emp, num_slice);
             }
         }
     };
-    DpfPirImpl(uint8_t server_id, size_t logN, string json_data_path) : server_id(server_id), logN(logN)
+    DpfPirImpl(uint8_t server_id, size_t logN, string json_data_path, KeywordMode mode, size_t num_threads, bool record_major) : server_id(server_id), logN(logN), mode(mode), num_threads(num_threads)
     {
-        std::ifstream file(json_data_path);
-        if (!file.is_open())
-        {
-            std::cerr << "Error opening file.\n";
-        }
-
-        json jsonData;
-        file >> jsonData;
-
         std::vector<std::string> db_keys;
         std::vector<std::string> db_elems;
-
-        for (auto it = jsonData.begin(); it != jsonData.end(); ++it)
-        {
-            db_keys.push_back(it.key());
-            db_elems.push_back(it.value());
-        }
+        readJsonData(json_data_path, db_keys, db_elems);
 
         this->num_slice = getnum(db_elems);
-        db.resize_data(num_slice);
-        assert(db_keys.size() <= ((1ULL << logN) - 1));
         assert(db_keys.size() == db_elems.size());
         this->db_size = db_keys.size();
-        // Fill Datastore
-        for (size_t i = 0; i < db_size; i++)
+        if (mode == dpfpir::KEYWORD_CUCKOO)
         {
-            this->db.push_back(db_keys[i], hashdatastore::KeywordType::HASH, str2vecstr(db_elems[i], num_slice), num_slice);
+            if (!buildCuckooTable(tables[0], db_keys, db_elems, num_slice, this->logN))
+                throw std::runtime_error("Could not build the cuckoo table of " + json_data_path);
         }
-        // Pad
-        if (db_size % 8 != 0)
+        else
         {
-            vector<string> emp;
-            for (size_t i = 0; i < num_slice; i++)
-            {
-                emp.push_back("");
-            }
-            for (size_t i = 0; i < (8 - db_size % 8); i++)
+            assert(db_keys.size() <= ((1ULL << logN) - 1));
+            buildSizeClassTables(tables, db_keys, db_elems);
+        }
+        if (record_major)
+        {
+            for (hashdatastore &db : tables)
             {
-                this->db.push_back("", hashdatastore::KeywordType::HASH, emp, num_slice);
+                db.to_record_major();
             }
         }
     };
+    // answers straight from a json2snapshot file, mode and logN are taken from it
+    DpfPirImpl(uint8_t server_id, string snapshot_path, size_t num_threads) : server_id(server_id), num_threads(num_threads)
+    {
+        hashdatastore::snapshot_header header;
+        if (!tables[0].load_snapshot(snapshot_path, header))
+            throw std::runtime_error("Invalid snapshot: " + snapshot_path);
+        // the header's mode and logN are the caller's to check; a cuckoo table holds at least one
+        // value slice besides the fingerprints
+        if ((header.mode != dpfpir::KEYWORD_HASH && header.mode != dpfpir::KEYWORD_CUCKOO) || header.logn > 63 ||
+            (header.mode == dpfpir::KEYWORD_CUCKOO && header.num_slice < 2))
+            throw std::runtime_error("Invalid snapshot: " + snapshot_path);
+        this->logN = header.logn;
+        this->mode = static_cast<KeywordMode>(header.mode);
+        // cuckoo tables carry the fingerprint slice on top of the values
+        this->num_slice = header.num_slice - (mode == dpfpir::KEYWORD_CUCKOO ? 1 : 0);
+        this->db_size = mode == dpfpir::KEYWORD_CUCKOO ? 0 : header.num_hashes;
+        std::cout << "Snapshot: " << header.num_rows << " rows, " << header.num_slice << " slices, logN " << logN << std::endl;
+    };
+
+    // moves the loaded tables to their final pages and picks the answer kernel on them for the
+    // thread count the batches run with, so setBatchThreads goes first
+    void prepare(hashdatastore::PageSize pages, hashdatastore::NumaPolicy numa)
+    {
+        for (hashdatastore &db : tables)
+        {
+            if ((pages != hashdatastore::PAGES_DEFAULT || numa != hashdatastore::NUMA_DEFAULT) && !db.place(pages, numa))
+                std::cerr << "Could not place the table (pages " << pages << ", numa " << numa << "), keeping it where it is" << std::endl;
+            db.autotune(batcher.threads(), &std::cout);
+        }
+    }
 
     Status DpfParams(ServerContext *context, const Info *request, Params *response)
     {
         const string client_id = context->client_metadata().find("client_id")->second.data();
-        std::cout << "[" << client_id << "] "
-                  << "1.Sending Params.";
+        if (verbose)
+            std::cout << "[" << client_id << "] "
+                      << "1.Sending Params.";
 
         response->set_logn(this->logN);
         response->set_num_slice(this->num_slice);
-        std::cout << "\r[" << client_id << "] "
-                  << "1.Params sent.   " << std::endl;
+        response->set_mode(this->mode);
+        if (this->mode == dpfpir::KEYWORD_CUCKOO)
+        {
+            response->set_num_hash(hashdatastore::CUCKOO_NUM_HASH);
+        }
+        if (verbose)
+            std::cout << "\r[" << client_id << "] "
+                      << "1.Params sent.   " << std::endl;
         return Status::OK;
     }
 
     Status DpfPir(ServerContext *context, const FuncKey *request, Answer *response)
     {
         const string client_id = context->client_metadata().find("client_id")->second.data();
-        std::cout << "\r[" << client_id << "] "
-                  << "2.PIR..." << std::flush;
+        if (verbose)
+            std::cout << "\r[" << client_id << "] "
+                      << "2.PIR..." << std::flush;
 
-        /* receive func_key */
-        std::vector<uint8_t> func_key(request->funckey().begin(), request->funckey().end());
+        if (this->mode == dpfpir::KEYWORD_CUCKOO)
+        {
+            std::string ans;
+            if (!answerCuckoo(request, ans))
+                return Status(StatusCode::INVALID_ARGUMENT, "malformed funckey");
+            response->set_answer(ans);
+            if (verbose)
+                std::cout << "\r[" << client_id << "] "
+                          << "2.PIR end." << std::endl;
+            return Status::OK;
+        }
 
-        /* make query vector */
-        std::vector<uint8_t> query;
-        DPF::EvalKeywords(func_key, db.hashs_, logN, query);
+        /* receive func_key, compact or Gen format */
+        std::vector<uint8_t> func_key;
+        if (!DPF::DecodeKey(std::vector<uint8_t>(request->funckey().begin(), request->funckey().end()), logN, func_key))
+            return Status(StatusCode::INVALID_ARGUMENT, "malformed funckey");
 
-        /* answer query */
-        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer;
-        for (size_t i = 0; i < num_slice; i++)
+        /* make query vectors, one per size class */
+        std::vector<std::vector<uint8_t>> queries(tables.size());
+        for (size_t c = 0; c < tables.size(); c++)
         {
-            answer.push_back(db.answer_pir2(query, i));
+            DPF::EvalPoints(func_key, tables[c].hashs_, logN, queries[c], num_threads);
         }
 
+        /* answer query, batched with concurrent calls */
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer = batcher.answer(queries);
+
         /* set answer */
         std::string ans;
         for (size_t i = 0; i < num_slice; i++)
@@ -157,12 +360,37 @@ public:
         /* send answer */
         response->set_answer(ans);
 
-        std::cout << "\r[" << client_id << "] "
-                  << "2.PIR end." << std::endl;
+        if (verbose)
+            std::cout << "\r[" << client_id << "] "
+                      << "2.PIR end." << std::endl;
         return Status::OK;
     }
 
 private:
+    bool answerCuckoo(const FuncKey *request, std::string &ans)
+    {
+        // one key per cuckoo hash function, each sized for the table's logN
+        if (request->cuckoo_funckeys_size() != static_cast<int>(hashdatastore::CUCKOO_NUM_HASH))
+            return false;
+        std::vector<std::vector<uint8_t>> func_keys(request->cuckoo_funckeys_size());
+        for (size_t h = 0; h < func_keys.size(); h++)
+        {
+            const std::string &key = request->cuckoo_funckeys(h);
+            if (key.size() != DPF::KeySize(logN) && key.size() != DPF::CompactKeySize(logN))
+                return false;
+            if (!DPF::DecodeKey(std::vector<uint8_t>(key.begin(), key.end()), logN, func_keys[h]))
+                return false;
+        }
+        /* full-domain evaluation and answer, batched with concurrent calls */
+        std::vector<hashdatastore::hash_type, hashdatastore::HashTypeAllocator> answer = batcher.answer(func_keys, logN);
+        // num_slice value slices and the fingerprint slice per key
+        for (size_t i = 0; i < answer.size(); i++)
+        {
+            ans += m256iToStr(answer[i]);
+        }
+        return true;
+    }
+
     // Convert __m256i to string
     std::string m256iToStr(__m256i value)
     {
@@ -177,56 +405,206 @@ private:
 
         return resultString;
     }
+};
+
+// Fixed set of compute workers fed from a bounded queue: Submit blocks while max_pending tasks are
+// waiting, which pushes back on the network threads instead of piling up work.
+class ComputePool
+{
+private:
+    std::mutex mu_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<std::function<void()>> tasks_;
+    size_t max_pending;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
 
-    std::vector<std::string> str2vecstr(std::string s, size_t num_slice)
+public:
+    ComputePool(size_t num_workers, size_t max_pending) : max_pending(max_pending)
     {
-        std::vector<std::string> result;
-        size_t n = s.size();
-        for (size_t i = 0; i < num_slice; i++)
+        for (size_t i = 0; i < num_workers; i++)
         {
-            if (n > 32)
-            {
-                result.push_back(s.substr(i * 32, 32));
-                n = n - 32;
-            }
-            else
-            {
-                result.push_back(s.substr(i * 32, n));
-                break;
-            }
+            workers_.emplace_back([this]
+                                  {
+                std::unique_lock<std::mutex> lock(mu_);
+                while (true)
+                {
+                    not_empty_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                    if (tasks_.empty())
+                        return;
+                    std::function<void()> task = std::move(tasks_.front());
+                    tasks_.pop_front();
+                    not_full_.notify_one();
+                    lock.unlock();
+                    task();
+                    lock.lock();
+                } });
+        }
+    }
+
+    ~ComputePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
         }
-        if (result.size() < num_slice)
+        not_empty_.notify_all();
+        for (std::thread &worker : workers_)
         {
-            result.resize(num_slice);
+            worker.join();
         }
-        return result;
     }
 
-    size_t getnum(std::vector<std::string> &s)
+    void Submit(std::function<void()> task)
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        not_full_.wait(lock, [this] { return tasks_.size() < max_pending; });
+        tasks_.push_back(std::move(task));
+        not_empty_.notify_one();
+    }
+};
+
+// completion queue tag of an outstanding async call
+class AsyncCall
+{
+public:
+    virtual ~AsyncCall() = default;
+    virtual void Proceed(bool ok) = 0;
+};
+
+// one unary call served through the async API: the handler of DpfPirImpl runs on the network
+// thread (pool == nullptr) or on a compute worker, and a fresh call is queued for the next client
+template <class Request, class Response>
+class AsyncUnaryCall final : public AsyncCall
+{
+public:
+    using RequestFn = void (DPFPIRInterface::AsyncService::*)(ServerContext *, Request *, grpc::ServerAsyncResponseWriter<Response> *, grpc::CompletionQueue *, grpc::ServerCompletionQueue *, void *);
+    using HandlerFn = Status (DpfPirImpl::*)(ServerContext *, const Request *, Response *);
+
+private:
+    DPFPIRInterface::AsyncService *service_;
+    grpc::ServerCompletionQueue *cq_;
+    DpfPirImpl *impl_;
+    RequestFn request_fn_;
+    HandlerFn handler_;
+    ComputePool *pool_;
+    ServerContext ctx_;
+    Request request_;
+    Response response_;
+    grpc::ServerAsyncResponseWriter<Response> responder_;
+    bool finished_ = false;
+
+public:
+    AsyncUnaryCall(DPFPIRInterface::AsyncService *service, grpc::ServerCompletionQueue *cq, DpfPirImpl *impl, RequestFn request_fn, HandlerFn handler, ComputePool *pool)
+        : service_(service), cq_(cq), impl_(impl), request_fn_(request_fn), handler_(handler), pool_(pool), responder_(&ctx_)
     {
-        size_t n = 0;
-        for (size_t i = 0; i < s.size(); i++)
+        (service_->*request_fn_)(&ctx_, &request_, &responder_, cq_, cq_, this);
+    }
+
+    void Proceed(bool ok) override
+    {
+        if (finished_ || !ok)
         {
-            if (s[i].size() > n)
-            {
-                n = s[i].size();
-            }
+            delete this;
+            return;
         }
-        if (n % 32 == 0)
+        new AsyncUnaryCall(service_, cq_, impl_, request_fn_, handler_, pool_);
+        if (pool_ == nullptr)
         {
-            return n / 32;
+            Handle();
+            return;
         }
-        return n / 32 + 1;
+        pool_->Submit([this]
+                      { Handle(); });
+    }
+
+private:
+    void Handle()
+    {
+        Status status = (impl_->*handler_)(&ctx_, &request_, &response_);
+        finished_ = true;
+        responder_.Finish(response_, status, this);
     }
 };
 
-void RunServer(uint8_t server_id)
+// physical cores from sysfs (hyperthread siblings counted once), falls back to logical cores
+size_t physicalCores()
+{
+    std::set<std::string> cores;
+    for (size_t cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++)
+    {
+        std::ifstream siblings("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+        std::string list;
+        if (!std::getline(siblings, list))
+            return std::max(1u, std::thread::hardware_concurrency());
+        cores.insert(list);
+    }
+    return std::max<size_t>(1, cores.size());
+}
+
+// network threads only move requests between their completion queue and the compute pool, DpfPir
+// runs on num_workers compute threads, each using the service's per-query thread count
+void RunAsyncServer(DpfPirImpl &service, const std::string &server_address, size_t num_net_threads, size_t num_workers)
+{
+    DPFPIRInterface::AsyncService async_service;
+    ServerBuilder builder;
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&async_service);
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs;
+    for (size_t i = 0; i < num_net_threads; i++)
+    {
+        cqs.push_back(builder.AddCompletionQueue());
+    }
+    std::unique_ptr<::grpc::Server> rpc_server(builder.BuildAndStart());
+    std::cout << "Async server listening on " << server_address << " (" << num_net_threads << " network threads, " << num_workers << " compute workers)" << std::endl;
+
+    ComputePool pool(num_workers, 4 * num_workers);
+    std::vector<std::thread> net_threads;
+    for (auto &cq : cqs)
+    {
+        new AsyncUnaryCall<Info, Params>(&async_service, cq.get(), &service, &DPFPIRInterface::AsyncService::RequestDpfParams, &DpfPirImpl::DpfParams, nullptr);
+        new AsyncUnaryCall<FuncKey, Answer>(&async_service, cq.get(), &service, &DPFPIRInterface::AsyncService::RequestDpfPir, &DpfPirImpl::DpfPir, &pool);
+        grpc::ServerCompletionQueue *queue = cq.get();
+        net_threads.emplace_back([queue]
+                                 {
+            void *tag;
+            bool ok;
+            while (queue->Next(&tag, &ok))
+            {
+                static_cast<AsyncCall *>(tag)->Proceed(ok);
+            } });
+    }
+
+    /* wait for call */
+    rpc_server->Wait();
+    for (auto &cq : cqs)
+    {
+        cq->Shutdown();
+    }
+    for (std::thread &t : net_threads)
+    {
+        t.join();
+    }
+}
+
+void RunServer(uint8_t server_id, KeywordMode mode, size_t num_threads, bool record_major, string snapshot_path, size_t async_net_threads, hashdatastore::PageSize pages, hashdatastore::NumaPolicy numa)
 {
     // vector<string> db_keys = {"a", "b", "c", "d"}; // logN = 22, max_bits = 2
     // vector<string> db_elems = {"AappleAappleAappleAappleAappleaaAappleAAHSJAappleAappleAappleAappleAappleaaAappleAAHSJ", "AbananaAbanana", "AcatAcat", "AdogAdog"};
     string json_path = "/home/yuance/Work/Encryption/PIR/code/PIR/dpf-pir/test/data/random_data.json";
     size_t logN = 48; // 48 bit hash for one million entries
-    DpfPirImpl service(server_id, logN, json_path);
+    std::unique_ptr<DpfPirImpl> service;
+    if (!snapshot_path.empty())
+        service.reset(new DpfPirImpl(server_id, snapshot_path, num_threads));
+    else
+        service.reset(new DpfPirImpl(server_id, logN, json_path, mode, num_threads, record_major));
+    // async: workers times per-query threads stay within the physical cores. the leader of a batch
+    // runs it while the other workers wait on it, so the batch gets the threads of the whole pool
+    const size_t num_workers = std::max<size_t>(1, physicalCores() / num_threads);
+    if (async_net_threads > 0)
+        service->setBatchThreads(num_workers * num_threads);
+    service->prepare(pages, numa);
 
     /* gRPC build */
     ServerBuilder builder;
@@ -238,8 +616,15 @@ void RunServer(uint8_t server_id)
     else
         throw std::invalid_argument("Invalid Server ID: " + std::to_string(server_id));
 
+    if (async_net_threads > 0)
+    {
+        service->setVerbose(false);
+        RunAsyncServer(*service, server_address, async_net_threads, num_workers);
+        return;
+    }
+
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
-    builder.RegisterService(&service);
+    builder.RegisterService(service.get());
 
     std::unique_ptr<::grpc::Server> rpc_server(builder.BuildAndStart());
     std::cout << "Server listening on " << server_address << std::endl;
@@ -253,11 +638,18 @@ int main(int argc, char *argv[])
 #pragma region args
     /* args */
     uint8_t server_id;
+    KeywordMode mode = dpfpir::KEYWORD_HASH;
+    size_t num_threads = std::thread::hardware_concurrency();
+    bool record_major = false;
+    string snapshot_path;
+    size_t async_net_threads = 0;
+    hashdatastore::PageSize pages = hashdatastore::PAGES_DEFAULT;
+    hashdatastore::NumaPolicy numa = hashdatastore::NUMA_DEFAULT;
     try
     {
         // def options
         po::options_description desc("Allowed options");
-        desc.add_options()("help,h", "Produce help message")("id", po::value<std::string>()->required(), "server id (0/1)");
+        desc.add_options()("help,h", "Produce help message")("id", po::value<std::string>()->required(), "server id (0/1)")("mode", po::value<std::string>()->default_value("hash"), "keyword mode (hash/cuckoo)")("threads", po::value<size_t>(), "worker threads per query (default: all cores)")("layout", po::value<std::string>()->default_value("slice"), "table layout (slice/record)")("snapshot", po::value<std::string>(), "serve a json2snapshot file instead of the JSON data (mode and layout come from the file)")("async", "async completion-queue server with a bounded compute pool (--threads defaults to 1 per query)")("net-threads", po::value<size_t>()->default_value(2), "network threads of the async server")("prefetch-distance", po::value<size_t>(), "bytes the prefetch answer kernels fetch ahead, 0 to only stream (autotuned with this distance)")("pages", po::value<std::string>()->default_value("default"), "table pages (default/thp/2m/1g), 2m and 1g need reserved hugetlbfs pages")("numa", po::value<std::string>()->default_value("default"), "table placement over NUMA nodes (default/interleave/partition)");
 
         // parse params
         po::variables_map vm;
@@ -277,6 +669,55 @@ int main(int argc, char *argv[])
             if (server_id != 0 && server_id != 1)
                 throw("Invalid Server ID: " + std::to_string(server_id));
         }
+
+        if (vm["mode"].as<std::string>() == "cuckoo")
+            mode = dpfpir::KEYWORD_CUCKOO;
+        else if (vm["mode"].as<std::string>() != "hash")
+            throw std::invalid_argument("Invalid mode: " + vm["mode"].as<std::string>());
+
+        if (vm.count("async"))
+        {
+            async_net_threads = vm["net-threads"].as<size_t>();
+            if (async_net_threads == 0)
+                throw std::invalid_argument("Invalid network thread count: 0");
+            num_threads = 1;
+        }
+
+        if (vm.count("threads"))
+        {
+            num_threads = vm["threads"].as<size_t>();
+            if (num_threads == 0)
+                throw std::invalid_argument("Invalid thread count: 0");
+        }
+
+        if (vm["layout"].as<std::string>() == "record")
+            record_major = true;
+        else if (vm["layout"].as<std::string>() != "slice")
+            throw std::invalid_argument("Invalid layout: " + vm["layout"].as<std::string>());
+
+        if (vm.count("snapshot"))
+            snapshot_path = vm["snapshot"].as<std::string>();
+
+        if (vm.count("prefetch-distance"))
+            hashdatastore::setPrefetchDistance(vm["prefetch-distance"].as<size_t>());
+
+        const std::string pages_arg = vm["pages"].as<std::string>();
+        if (pages_arg == "thp")
+            pages = hashdatastore::PAGES_TRANSPARENT;
+        else if (pages_arg == "2m")
+            pages = hashdatastore::PAGES_HUGETLB_2M;
+        else if (pages_arg == "1g")
+            pages = hashdatastore::PAGES_HUGETLB_1G;
+        else if (pages_arg != "default")
+            throw std::invalid_argument("Invalid pages: " + pages_arg);
+
+        const std::string numa_arg = vm["numa"].as<std::string>();
+        if (numa_arg == "interleave")
+            numa = hashdatastore::NUMA_INTERLEAVE;
+        else if (numa_arg == "partition")
+            numa = hashdatastore::NUMA_PARTITION;
+        else if (numa_arg != "default")
+            throw std::invalid_argument("Invalid numa policy: " + numa_arg);
     }
     catch (const std::exception &e)
     {
@@ -286,6 +727,6 @@ int main(int argc, char *argv[])
 #pragma endregion args
 
     /* run */
-    RunServer(server_id);
+    RunServer(server_id, mode, num_threads, record_major, snapshot_path, async_net_threads, pages, numa);
     return 0;
 }
\ No newline at end of file